@@ -0,0 +1,759 @@
+/*
+benchmarks for entitycs.h. the results are written as json (google benchmark format) to stdout.
+
+g++ -std=c++11 -O2 -pthread -I.. benchmark.cpp -o benchmark
+g++ -std=c++11 -O2 -pthread -I.. -DECS_ARCHETYPE_STORAGE benchmark.cpp -o benchmark_archetype
+
+usage: benchmark [filter]
+only benchmarks that contain filter in their name are executed
+*/
+#include "entitycs.h"
+#include <iostream>
+#include <string>
+#include <cstring>
+
+struct Transform
+{
+	float x = 0.0f, y = 0.0f, z = 0.0f;
+};
+struct Movement
+{
+	float vx = 1.0f, vy = 2.0f, vz = 3.0f;
+};
+struct Health
+{
+	float value = 100.0f;
+};
+struct Armor
+{
+	float value = 10.0f;
+};
+struct Tag
+{
+	int id = 0;
+};
+struct Selected
+{
+	int id = 0;
+};
+struct Position
+{
+	float x = 0.0f, y = 0.0f;
+};
+namespace ecs
+{
+	template<>
+	struct SparseStorage<Selected> : std::true_type
+	{};
+	template<>
+	struct TrackChanges<Position> : std::true_type
+	{};
+}
+
+#define SYSTEM Transform, Movement, Health, Armor, Tag, Selected, Position
+using ManagerT = ecs::Manager<SYSTEM>;
+using EntityT = ecs::Entity<SYSTEM>;
+
+// prevents the compiler from removing the result
+template<class T>
+void doNotOptimize(const T& value)
+{
+	static volatile T sink;
+	sink = value;
+	(void)sink;
+}
+
+class Benchmarks
+{
+public:
+	explicit Benchmarks(const char* filter)
+		:
+	m_filter(filter)
+	{}
+	~Benchmarks()
+	{
+		std::cout << "\n]}\n";
+	}
+	void begin()
+	{
+#ifdef ECS_ARCHETYPE_STORAGE
+		const char* storage = "archetype";
+#else
+		const char* storage = "tuple";
+#endif
+		std::cout << "{\"context\":{\"library\":\"entitycs\",\"storage\":\"" << storage
+			<< "\",\"num_cpus\":" << std::thread::hardware_concurrency() << "},\n\"benchmarks\":[";
+	}
+	/*
+	runs func(iterations) until it took at least s_minTime and reports the time per iteration.
+	setup is called once before every measurement
+	*/
+	template<class TSetup, class TFunc>
+	void run(const std::string& name, TSetup setup, TFunc func)
+	{
+		if (m_filter && name.find(m_filter) == std::string::npos)
+		{
+			m_counters.clear();
+			return;
+		}
+		size_t iterations = 1;
+		long long time = 0;
+		while (true)
+		{
+			setup();
+			auto start = std::chrono::high_resolution_clock::now();
+			func(iterations);
+			time = (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - start).count();
+			if (time >= s_minTime || iterations >= s_maxIterations)
+				break;
+			iterations *= time > s_minTime / 100 ? 2 : 10;
+		}
+		report(name, iterations, time);
+	}
+	template<class TFunc>
+	void run(const std::string& name, TFunc func)
+	{
+		run(name, []() {}, func);
+	}
+	// like run, but func(iterations) measures the time itself and returns the nanoseconds
+	template<class TFunc>
+	void runTimed(const std::string& name, TFunc func)
+	{
+		if (m_filter && name.find(m_filter) == std::string::npos)
+		{
+			m_counters.clear();
+			return;
+		}
+		size_t iterations = 1;
+		long long time = 0;
+		while (true)
+		{
+			time = func(iterations);
+			if (time >= s_minTime || iterations >= s_maxIterations)
+				break;
+			iterations *= time > s_minTime / 100 ? 2 : 10;
+		}
+		report(name, iterations, time);
+	}
+	// user counter (e.g. bytes) that is reported with the next benchmark
+	void counter(const std::string& name, double value)
+	{
+		m_counters.push_back(std::make_pair(name, value));
+	}
+private:
+	void report(const std::string& name, size_t iterations, long long time)
+	{
+		std::cout << (m_first ? "\n" : ",\n") << "{\"name\":\"" << name << "\",\"iterations\":" << iterations
+			<< ",\"real_time\":" << double(time) / double(iterations) << ",\"time_unit\":\"ns\"";
+		for (auto& c : m_counters)
+			std::cout << ",\"" << c.first << "\":" << c.second;
+		std::cout << "}";
+		std::cout.flush();
+		m_counters.clear();
+		m_first = false;
+	}
+private:
+	static const long long s_minTime = 200000000;
+	static const size_t s_maxIterations = 1000000000;
+	const char* m_filter;
+	bool m_first = true;
+	std::vector<std::pair<std::string, double>> m_counters;
+};
+
+// n entities with Transform + Movement, every second one with Health + Armor
+static void spawn(ManagerT& m, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		auto e = m.addEntity();
+		e->addComponent<Transform>();
+		e->addComponent<Movement>();
+		if (i % 2 == 0)
+		{
+			e->addComponent<Health>();
+			e->addComponent<Armor>();
+		}
+	}
+	m.tick(0.0f);
+}
+
+static void iteration(Benchmarks& b)
+{
+	for (size_t n : { 1000, 100000 })
+	{
+		const std::string suffix = "/" + std::to_string(n);
+		ManagerT m;
+		m.start();
+		spawn(m, n);
+
+		b.run("forEach/2" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.forEach<Transform, Movement>([](EntityT& e)
+				{
+					auto& t = e.getComponent<Transform>();
+					const auto& v = e.getComponent<Movement>();
+					t.x += v.vx;
+					t.y += v.vy;
+					t.z += v.vz;
+				});
+		});
+		b.run("forEach/4" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.forEach<Transform, Movement, Health, Armor>([](EntityT& e)
+				{
+					e.getComponent<Transform>().x += e.getComponent<Movement>().vx;
+					e.getComponent<Health>().value -= e.getComponent<Armor>().value;
+				});
+		});
+		b.run("each/2" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.each<Transform, const Movement>([](Transform& t, const Movement& v)
+				{
+					t.x += v.vx;
+					t.y += v.vy;
+					t.z += v.vz;
+				});
+		});
+		b.run("each/4" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.each<Transform, const Movement, Health, const Armor>([](Transform& t, const Movement& v, Health& h, const Armor& a)
+				{
+					t.x += v.vx;
+					h.value -= a.value;
+				});
+		});
+		b.run("forEachChunk/2" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.forEachChunk<Transform, const Movement>([](size_t count, Transform* t, const Movement* v)
+				{
+					for (size_t j = 0; j < count; j++)
+					{
+						t[j].x += v[j].vx;
+						t[j].y += v[j].vy;
+						t[j].z += v[j].vz;
+					}
+				});
+		});
+		b.run("forEachParallel/2" + suffix, [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.forEachParallel<Transform, Movement>([](EntityT& e)
+				{
+					auto& t = e.getComponent<Transform>();
+					const auto& v = e.getComponent<Movement>();
+					t.x += v.vx;
+					t.y += v.vy;
+					t.z += v.vz;
+				});
+		});
+	}
+}
+
+static void queries(Benchmarks& b)
+{
+	const size_t n = 100000;
+	ManagerT m;
+	m.start();
+	spawn(m, n);
+	// the first call of a manager creates the query from all entities
+	b.runTimed("getEntsWith/uncached/100000", [n](size_t it)
+	{
+		long long time = 0;
+		for (size_t i = 0; i < it; i++)
+		{
+			ManagerT fresh;
+			fresh.start();
+			spawn(fresh, n);
+			auto start = std::chrono::high_resolution_clock::now();
+			doNotOptimize(fresh.getEntsWith<Health, Armor>().size());
+			time += (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - start).count();
+		}
+		return time;
+	});
+	m.getEntsWith<Health, Armor>();
+	b.run("getEntsWith/cached/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			doNotOptimize(m.getEntsWith<Health, Armor>().size());
+	});
+}
+
+static void churn(Benchmarks& b)
+{
+	for (size_t n : { 1000, 10000 })
+	{
+		ManagerT m;
+		m.addQuery<Transform>();
+		m.addQuery<Health, Armor>();
+		m.start();
+		spawn(m, 100000);
+		// spawns n entities and kills the n oldest entities per tick
+		b.run("spawnKill/" + std::to_string(n), [&m, n](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+			{
+				auto& ents = m.getEntsWith<>();
+				for (size_t j = 0; j < n && j < ents.size(); j++)
+					ents[j]->kill();
+				for (size_t j = 0; j < n; j++)
+				{
+					auto e = m.addEntity();
+					e->addComponent<Transform>();
+					if (j % 2)
+						e->addComponent<Health>();
+				}
+				m.tick(0.0f);
+			}
+		});
+	}
+	ManagerT m;
+	m.addQuery<Transform>();
+	m.addQuery<Health, Armor>();
+	m.start();
+	spawn(m, 100000);
+	// spawns and kills 10000 entities per tick with one addEntities call
+	b.run("spawnKillBatch/10000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			auto& ents = m.getEntsWith<>();
+			for (size_t j = 0; j < 10000 && j < ents.size(); j++)
+				ents[j]->kill();
+			m.addEntities<Transform, Health>(10000, [](EntityT& e, size_t j)
+			{
+				e.getComponent<Transform>().x = float(j);
+			});
+			m.tick(0.0f);
+		}
+	});
+	// kills a few entities of a large manager
+	b.run("killFew/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			auto& ents = m.getEntsWith<>();
+			for (size_t j = 0; j < 10; j++)
+				ents[(i * 7919 + j * 104729) % ents.size()]->kill();
+			for (size_t j = 0; j < 10; j++)
+				m.addEntity()->addComponent<Transform>();
+			m.tick(0.0f);
+		}
+	});
+}
+
+static void toggle(Benchmarks& b)
+{
+	ManagerT m;
+	m.addQuery<Transform>();
+	m.addQuery<Health, Armor>();
+	m.start();
+	spawn(m, 100000);
+	// adds and removes a component of 1000 entities per tick
+	b.run("toggle/dense/1000", [&m](size_t it)
+	{
+		auto& ents = m.getEntsWith<>();
+		for (size_t i = 0; i < it; i++)
+		{
+			for (size_t j = 0; j < 1000; j++)
+			{
+				if (i % 2)
+					ents[j]->removeComponent<Tag>();
+				else
+					ents[j]->addComponent<Tag>();
+			}
+			m.tick(0.0f);
+		}
+	});
+	b.run("toggle/sparse/1000", [&m](size_t it)
+	{
+		auto& ents = m.getEntsWith<>();
+		for (size_t i = 0; i < it; i++)
+		{
+			for (size_t j = 0; j < 1000; j++)
+			{
+				if (i % 2)
+					ents[j]->removeComponent<Selected>();
+				else
+					ents[j]->addComponent<Selected>();
+			}
+			m.tick(0.0f);
+		}
+	});
+	for (size_t j = 0; j < 1000; j++)
+		m.getEntsWith<>()[j * 100]->addComponent<Selected>().id = int(j);
+	// the sparse set is smaller than the query of Transform
+	b.run("forEach/sparse/1000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			m.forEach<Transform, Selected>([](EntityT& e)
+			{
+				e.getComponent<Transform>().x += float(e.getComponent<Selected>().id);
+			});
+	});
+}
+
+static void changes(Benchmarks& b)
+{
+	ManagerT m;
+	m.start();
+	for (size_t i = 0; i < 100000; i++)
+		m.addEntity()->addComponent<Position>().x = float(i);
+	m.tick(0.0f);
+	auto& ents = m.getEntsWith<Position>();
+	// 1% of the positions change per tick, the system only processes the changed ones
+	uint64_t version = m.advanceChangeVersion();
+	b.run("forEachChanged/1000/100000", [&m, &ents, &version](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			for (size_t j = 0; j < 1000; j++)
+				ents[(i * 1000 + j) % ents.size()]->getComponent<Position>().y += 1.0f;
+			float sum = 0.0f;
+			m.forEachChanged<Position>(version, [&sum](const EntityT& e)
+			{
+				sum += e.getComponent<Position>().y;
+			});
+			version = m.advanceChangeVersion();
+			doNotOptimize(sum);
+		}
+	});
+}
+
+static void snapshots(Benchmarks& b)
+{
+	const size_t n = 100000;
+	std::vector<char> snapshot;
+	{
+		ManagerT m;
+		m.start();
+		spawn(m, n);
+		b.run("saveSnapshot/100000", [&m, &snapshot](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+			{
+				snapshot.clear();
+				m.saveSnapshot(snapshot);
+			}
+		});
+		// the benchmark may be filtered out
+		if (snapshot.empty())
+			m.saveSnapshot(snapshot);
+	}
+	// a new manager that is filled entity by entity or from the snapshot
+	b.runTimed("spawn/100000", [n](size_t it)
+	{
+		long long time = 0;
+		for (size_t i = 0; i < it; i++)
+		{
+			ManagerT m;
+			m.addQuery<Transform, Movement>();
+			m.start();
+			auto start = std::chrono::high_resolution_clock::now();
+			spawn(m, n);
+			time += (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - start).count();
+		}
+		return time;
+	});
+	b.runTimed("loadSnapshot/100000", [&snapshot](size_t it)
+	{
+		long long time = 0;
+		for (size_t i = 0; i < it; i++)
+		{
+			ManagerT m;
+			m.addQuery<Transform, Movement>();
+			m.start();
+			auto start = std::chrono::high_resolution_clock::now();
+			doNotOptimize(m.loadSnapshot(snapshot.data(), snapshot.size()));
+			time += (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - start).count();
+		}
+		return time;
+	});
+}
+
+static void deltas(Benchmarks& b)
+{
+	ManagerT server, client;
+	server.start();
+	server.setDeltaHistory(true);
+	for (size_t i = 0; i < 100000; i++)
+		server.addEntity()->addComponent<Position>().x = float(i);
+	server.tick(0.0f);
+	std::vector<char> data;
+	server.saveSnapshot(data);
+	client.start();
+	client.loadSnapshot(data.data(), data.size());
+	auto& ents = server.getEntsWith<Position>();
+	// 1% of the positions change per tick, the same delta is applied in every iteration
+	uint64_t version = server.advanceChangeVersion();
+	b.run("saveDelta/1000/100000", [&server, &ents, &version, &data](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			for (size_t j = 0; j < 1000; j++)
+				ents[(i * 1000 + j) % ents.size()]->getComponent<Position>().y += 1.0f;
+			data.clear();
+			server.saveDelta(version, data);
+			version = server.advanceChangeVersion();
+			server.trimDeltaHistory(version);
+		}
+	});
+	b.run("applyDelta/1000/100000", [&client, &data](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			doNotOptimize(client.applyDelta(data.data(), data.size()));
+	});
+}
+
+static void published(Benchmarks& b)
+{
+	ManagerT m;
+	m.publishQuery<Transform, Movement>();
+	m.start();
+	spawn(m, 100000);
+	// the copy at the end of every tick
+	b.run("publishQuery/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			m.tick(0.0f);
+	});
+	b.run("readQuery/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			auto view = m.readQuery<Transform, Movement>();
+			float sum = 0.0f;
+			for (auto& t : view->getColumn<Transform>())
+				sum += t.x;
+			doNotOptimize(sum);
+		}
+	});
+}
+
+static void hierarchy(Benchmarks& b)
+{
+	ManagerT m;
+	m.start();
+	// 10000 trees with 10 entities, every entity has up to 3 children
+	std::vector<EntityT*> tree;
+	for (size_t i = 0; i < 100000; i++)
+	{
+		auto e = m.addEntity();
+		e->addComponent<Transform>();
+		e->addComponent<Movement>();
+		if (i % 10 == 0)
+			tree.clear();
+		else
+			e->setParent(tree[(tree.size() - 1) / 3]);
+		tree.push_back(e);
+	}
+	m.tick(0.0f);
+	// world position = parent position + local offset
+	b.run("forEachHierarchical/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			m.forEachHierarchical<Transform, Movement>([](EntityT& e, EntityT* parent)
+			{
+				auto& t = e.getComponent<Transform>();
+				const auto& local = e.getComponent<Movement>();
+				t.x = local.vx;
+				t.y = local.vy;
+				t.z = local.vz;
+				if (parent)
+				{
+					const auto& p = parent->getComponent<Transform>();
+					t.x += p.x;
+					t.y += p.y;
+					t.z += p.z;
+				}
+			});
+		}
+	});
+}
+
+class CounterScript : public ecs::Script<SYSTEM>
+{
+public:
+	void tickEntity(EntityT& e, float dt) override
+	{
+		e.getComponent<Transform>().x += dt;
+	}
+	bool isThreadSafe() const override
+	{
+		return true;
+	}
+};
+class KillScript : public ecs::Script<SYSTEM>
+{
+public:
+	void tick(float) override
+	{
+		if (getEntity().getComponent<Transform>().x < 0.0f)
+			getEntity().kill();
+	}
+};
+
+static void scripts(Benchmarks& b)
+{
+	for (bool batching : { false, true })
+	{
+		ManagerT m;
+		m.setScriptBatching(batching);
+		m.start();
+		auto counter = std::make_shared<CounterScript>();
+		for (size_t i = 0; i < 10000; i++)
+		{
+			auto e = m.addEntity();
+			e->addComponent<Transform>();
+			e->addScript(counter);
+			e->addScript(std::make_shared<KillScript>());
+		}
+		m.tick(0.0f);
+		b.run(std::string("scripts/") + (batching ? "batched" : "entity") + "/10000", [&m](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				m.tick(0.01f);
+		});
+	}
+}
+
+static void dispatch(Benchmarks& b)
+{
+	// empty parallel loop over a few entities on pools of 1 to 8 threads, the manager should decide to stay on one thread for small loops
+	for (size_t workers : { 0, 1, 3, 7 })
+	{
+		for (size_t n : { 100, 10000, 1000000 })
+		{
+			ManagerT m(std::make_shared<ecs::ThreadPool>(workers));
+			m.start();
+			for (size_t i = 0; i < n; i++)
+				m.addEntity()->addComponent<Tag>().id = int(i);
+			m.tick(0.0f);
+			b.run("forEachParallel/empty/" + std::to_string(n) + "/" + std::to_string(workers + 1), [&m](size_t it)
+			{
+				for (size_t i = 0; i < it; i++)
+					m.forEachParallel<Tag>([](EntityT& e)
+					{
+						doNotOptimize(e.getComponent<Tag>().id);
+					});
+			});
+		}
+	}
+	// cost of waking up the workers
+	for (size_t workers : { 1, 3, 7 })
+	{
+		ecs::ThreadPool pool(workers);
+		std::atomic<size_t> counter{ 0 };
+		auto task = [&counter](size_t) { counter.fetch_add(1, std::memory_order_relaxed); };
+		b.run("ThreadPool::run/" + std::to_string(workers + 1), [&pool, &task, workers](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				pool.run(workers + 1, task);
+		});
+		auto range = [&counter](size_t begin, size_t end) { counter.fetch_add(end - begin, std::memory_order_relaxed); };
+		b.run("ThreadPool::runStealing/" + std::to_string(workers + 1), [&pool, &range](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				pool.runStealing(100000, 1024, range);
+		});
+	}
+}
+
+static void worlds(Benchmarks& b)
+{
+	// 50 worlds with 1000 entities on one pool
+	auto pool = std::make_shared<ecs::ThreadPool>();
+	std::vector<std::unique_ptr<ManagerT>> managers;
+	ecs::WorldGroup group(pool);
+	for (size_t i = 0; i < 50; i++)
+	{
+		managers.push_back(std::unique_ptr<ManagerT>(new ManagerT(pool)));
+		managers.back()->start();
+		spawn(*managers.back(), 1000);
+		group.add(*managers.back());
+	}
+	b.run("WorldGroup::tick/50/1000", [&group](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			group.tick(0.0f);
+	});
+	// constructing a world on a shared pool does not start threads
+	b.run("Manager/shared", [&pool](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+		{
+			ManagerT m(pool);
+			doNotOptimize(m.getThreadCount());
+		}
+	});
+}
+
+static void memory(Benchmarks& b)
+{
+	ManagerT m;
+	m.start();
+	spawn(m, 100000);
+	m.tick(0.0f);
+	b.run("memoryStats/100000", [&m](size_t it)
+	{
+		for (size_t i = 0; i < it; i++)
+			doNotOptimize(m.memoryStats().total());
+	});
+	// a small world (64 entities, one query) with the default capacity and with a capacity hint, on a shared pool so no threads are started.
+	// the counters report the memory of the world
+	const auto& pool = m.getThreadPool();
+	ecs::ManagerCapacity small;
+	small.entities = 64;
+	small.freshEntities = 16;
+	small.queryEntities = 64;
+	small.queries = 8;
+	for (auto& c : { std::make_pair(std::string("default"), ecs::ManagerCapacity()), std::make_pair(std::string("capacity"), small) })
+	{
+		auto create = [&pool, &c]()
+		{
+			std::unique_ptr<ManagerT> w(new ManagerT(pool, c.second));
+			w->addQuery<Transform, Movement>();
+			w->start();
+			spawn(*w, 64);
+			w->tick(0.0f);
+			return w;
+		};
+		const ecs::MemoryStats stats = create()->memoryStats();
+		b.counter("bytes", double(stats.total()));
+		b.counter("slack", double(stats.slack));
+		b.run("Manager/" + c.first + "/64", [&create](size_t it)
+		{
+			for (size_t i = 0; i < it; i++)
+				doNotOptimize(create()->getThreadCount());
+		});
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Benchmarks b(argc > 1 ? argv[1] : nullptr);
+	b.begin();
+	iteration(b);
+	queries(b);
+	churn(b);
+	toggle(b);
+	changes(b);
+	snapshots(b);
+	deltas(b);
+	published(b);
+	hierarchy(b);
+	scripts(b);
+	dispatch(b);
+	worlds(b);
+	memory(b);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+checks that corrupt snapshots and deltas are rejected before they change the manager.
+prints the failed checks and returns 1 if any check failed.
+
+g++ -std=c++11 -O2 -pthread -I.. snapshot_check.cpp -o snapshot_check
+g++ -std=c++11 -O2 -pthread -I.. -DECS_ARCHETYPE_STORAGE snapshot_check.cpp -o snapshot_check_archetype
+*/
+#include "entitycs.h"
+#include <iostream>
+#include <cstring>
+
+struct Position
+{
+	float x, y;
+};
+struct Health
+{
+	int value;
+};
+namespace ecs
+{
+	template<> struct TrackChanges<Position> : std::true_type {};
+}
+
+using ManagerT = ecs::Manager<Position, Health>;
+using EntityT = ecs::Entity<Position, Health>;
+
+static const size_t s_components = 2;
+static const size_t s_recordSize = sizeof(uint64_t) * (1 + ecs::componentMaskWords(s_components));
+static int s_failed = 0;
+
+static void check(bool condition, const char* name)
+{
+	if (!condition)
+	{
+		std::cout << "failed: " << name << "\n";
+		s_failed++;
+	}
+}
+
+// 100 entities with Position + Health and 50 with Position
+static void spawn(ManagerT& m)
+{
+	m.addEntities<Position, Health>(100, [](EntityT& e, size_t i)
+	{
+		e.getComponent<Position>().x = float(i);
+		e.getComponent<Health>().value = int(i);
+	});
+	m.addEntities<Position>(50, [](EntityT& e, size_t i)
+	{
+		e.getComponent<Position>().x = float(i);
+	});
+	m.tick(0.0f);
+}
+
+static bool load(const std::vector<char>& data)
+{
+	ManagerT m;
+	m.start();
+	const bool ok = m.loadSnapshot(data.data(), data.size());
+	check(ok || m.getEntsWith<Position>().empty(), "a rejected snapshot does not spawn entities");
+	return ok;
+}
+
+static void snapshots()
+{
+	ManagerT m;
+	m.start();
+	spawn(m);
+	std::vector<char> snapshot;
+	m.saveSnapshot(snapshot);
+	check(load(snapshot), "a valid snapshot is loaded");
+
+	// the snapshot ends with the lengths of the columns followed by the columns
+	const size_t columns = 150 * sizeof(Position) + 100 * sizeof(Health);
+	const size_t lengths = snapshot.size() - columns - s_components * sizeof(uint64_t);
+	const size_t records = lengths - 150 * s_recordSize;
+
+	std::vector<char> truncated(snapshot.begin(), snapshot.begin() + snapshot.size() / 2);
+	check(!load(truncated), "a truncated snapshot is rejected");
+
+	// the sum of the lengths still fits, but the last column is longer than the snapshot
+	std::vector<char> corrupt = snapshot;
+	uint64_t length = 0;
+	std::memcpy(corrupt.data() + lengths, &length, sizeof(length));
+	length = uint64_t(corrupt.size());
+	std::memcpy(corrupt.data() + lengths + sizeof(uint64_t), &length, sizeof(length));
+	check(!load(corrupt), "a column longer than the snapshot is rejected");
+
+	// the last column misses a value, all lengths are within the data
+	std::vector<char> shortColumn(snapshot.begin(), snapshot.end() - sizeof(Health));
+	length = 99 * sizeof(Health);
+	std::memcpy(shortColumn.data() + lengths + sizeof(uint64_t), &length, sizeof(length));
+	check(!load(shortColumn), "a column with too few values is rejected");
+
+	// the second entity has the ID of the first one
+	std::vector<char> duplicate = snapshot;
+	std::memcpy(duplicate.data() + records + s_recordSize, duplicate.data() + records, sizeof(uint64_t));
+	check(!load(duplicate), "duplicate IDs are rejected");
+}
+
+static void deltas()
+{
+	ManagerT server, client;
+	server.start();
+	client.start();
+	server.setDeltaHistory(true);
+	spawn(server);
+	std::vector<char> snapshot;
+	server.saveSnapshot(snapshot);
+	check(client.loadSnapshot(snapshot.data(), snapshot.size()), "the client starts with a snapshot");
+
+	uint64_t version = server.advanceChangeVersion();
+	server.addEntities<Position>(10, [](EntityT&, size_t) {});
+	server.tick(0.0f);
+	std::vector<char> spawned;
+	server.saveDelta(version, spawned);
+	check(client.applyDelta(spawned.data(), spawned.size()), "a delta with spawned entities is applied");
+	check(!client.applyDelta(spawned.data(), spawned.size()), "spawned entities that already exist are rejected");
+	check(client.getEntsWith<Position>().size() == 160, "the entities of a rejected delta are not spawned");
+
+	version = server.advanceChangeVersion();
+	auto& ents = server.getEntsWith<Position>();
+	ents[0]->getComponent<Position>().y = 1.0f;
+	ents[1]->getComponent<Position>().y = 2.0f;
+	std::vector<char> changed;
+	server.saveDelta(version, changed);
+	// the changed positions are the last column of the delta
+	std::vector<char> shortColumn(changed.begin(), changed.end() - sizeof(Position));
+	const uint64_t length = sizeof(Position);
+	std::memcpy(shortColumn.data() + shortColumn.size() - sizeof(Position) - sizeof(uint64_t), &length, sizeof(length));
+	check(!client.applyDelta(shortColumn.data(), shortColumn.size()), "changed values with too few bytes are rejected");
+	check(client.applyDelta(changed.data(), changed.size()), "a delta with changed values is applied");
+}
+
+int main()
+{
+	snapshots();
+	deltas();
+	if (!s_failed)
+		std::cout << "all checks passed\n";
+	return s_failed ? 1 : 0;
+}
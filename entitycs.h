@@ -6,626 +6,5026 @@
 #include <chrono>
 #include <cassert>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+#include <functional>
+#include <typeindex>
+#include <deque>
+#include <array>
+#include <cstring>
+#ifdef ECS_PROFILER
+#include <ostream>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace ecs
 {
 	using std::shared_ptr;
 	using std::make_shared;
-	using SystemKeyT = uint64_t;
 
-	template<typename... TComponents>
-	class Manager;
+	// number of 64 bit words required for a mask with one bit per component
+	constexpr size_t componentMaskWords(size_t nComponents)
+	{
+		return nComponents > 64 ? (nComponents + 63) / 64 : 1;
+	}
 
-	template<typename... TComponents>
-	class Entity;
+	// word of a mask with the bits of all indices, indices outside of the mask are ignored
+	constexpr uint64_t componentMaskWord(size_t)
+	{
+		return 0;
+	}
+	template<typename... TIndices>
+	constexpr uint64_t componentMaskWord(size_t word, size_t index, TIndices... indices)
+	{
+		return (index / 64 == word ? uint64_t(1) << (index % 64) : 0) | componentMaskWord(word, indices...);
+	}
 
-	template<typename... TComponents>
-	class Script
+	template<size_t... Is>
+	struct IndexSequence
+	{};
+	template<size_t N, size_t... Is>
+	struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...>
+	{};
+	template<size_t... Is>
+	struct MakeIndexSequence<0, Is...>
 	{
-	public:
-		using EntityT = Entity<TComponents...>;
-		using ManagerT = Manager<TComponents...>;
-		friend EntityT;
+		using type = IndexSequence<Is...>;
+	};
 
-		virtual ~Script() = default;
-		// called on game start or spawn
-		virtual void begin() {}
-		// called every frame
-		virtual void tick(float dt) {}
+	// position of T in Ts, does not compile if T is not one of Ts
+	template<typename T, typename... Ts>
+	struct ComponentIndex : std::integral_constant<size_t, 0>
+	{
+		static_assert(sizeof(T) == 0, "component type does not exist in this system");
+	};
+	template<typename T, typename... Ts>
+	struct ComponentIndex<T, T, Ts...> : std::integral_constant<size_t, 0>
+	{};
+	template<typename T, typename U, typename... Ts>
+	struct ComponentIndex<T, U, Ts...> : std::integral_constant<size_t, 1 + ComponentIndex<T, Ts...>::value>
+	{};
 
-	protected:
-		EntityT& getEntity()
+	// true if T is one of Ts
+	template<typename T, typename... Ts>
+	struct ContainsType : std::false_type
+	{};
+	template<typename T, typename U, typename... Ts>
+	struct ContainsType<T, U, Ts...> : std::integral_constant<bool,
+		std::is_same<T, U>::value || ContainsType<T, Ts...>::value>
+	{};
+
+	// true if no type occurs twice in Ts
+	template<typename... Ts>
+	struct UniqueTypes : std::true_type
+	{};
+	template<typename T, typename... Ts>
+	struct UniqueTypes<T, Ts...> : std::integral_constant<bool,
+		!ContainsType<T, Ts...>::value && UniqueTypes<Ts...>::value>
+	{};
+
+	// true if all Ts can be copied (only the components of published queries have to be)
+	template<typename... Ts>
+	struct CopyableTypes : std::true_type
+	{};
+	template<typename T, typename... Ts>
+	struct CopyableTypes<T, Ts...> : std::integral_constant<bool,
+		std::is_copy_constructible<T>::value && std::is_copy_assignable<T>::value && CopyableTypes<Ts...>::value>
+	{};
+
+	/*
+	fixed size bitset with one bit per component type.
+	the number of words is known at compile time so the loops will be unrolled (and vectorized) by the compiler
+	*/
+	template<size_t TWords>
+	class ComponentMask
+	{
+	public:
+		ComponentMask() noexcept
 		{
-			assert(m_curEntity);
-			return *m_curEntity;
+			for (size_t i = 0; i < TWords; i++)
+				m_words[i] = 0;
 		}
-		const EntityT& getEntity() const
+		// mask with the bits of all indices, can be evaluated at compile time
+		template<typename... TIndices>
+		static constexpr ComponentMask fromIndices(TIndices... indices) noexcept
 		{
-			assert(m_curEntity);
-			return *m_curEntity;
+			return ComponentMask(typename MakeIndexSequence<TWords>::type(), indices...);
 		}
-		ManagerT& getManager() const
+		// mask with only the bit of the component index
+		static ComponentMask bit(size_t index) noexcept
 		{
-			assert(m_manager);
-			return *m_manager;
+			ComponentMask m;
+			m.set(index);
+			return m;
 		}
-	private:
-		EntityT* m_curEntity = nullptr;
-		ManagerT* m_manager = nullptr;
-	};
-
-	template<typename... TComponents>
-	class System
-	{
-	public:
-		using EntityT = Entity<TComponents...>;
-		using ManagerT = Manager<TComponents...>;
-		friend ManagerT;
-
-		virtual ~System() = default;
-
-		virtual void initQueries(ManagerT& m) {}
-		virtual void begin() {}
-		virtual void tick(float dt) {}
-		virtual void onEntitySpawn(shared_ptr<EntityT> e) {}
-		virtual void onEntityDeath(shared_ptr<EntityT> e) {}
-	protected:
-		ManagerT& getManager() const
+		void set(size_t index) noexcept
 		{
-			assert(m_manager);
-			return *m_manager;
+			m_words[index / 64] |= uint64_t(1) << (index % 64);
+		}
+		void reset(size_t index) noexcept
+		{
+			m_words[index / 64] &= ~(uint64_t(1) << (index % 64));
+		}
+		bool test(size_t index) const noexcept
+		{
+			return (m_words[index / 64] & (uint64_t(1) << (index % 64))) != 0;
 		}
+		bool none() const noexcept
+		{
+			uint64_t any = 0;
+			for (size_t i = 0; i < TWords; i++)
+				any |= m_words[i];
+			return any == 0;
+		}
+		// true if all bits of o are set in this mask
+		bool contains(const ComponentMask& o) const noexcept
+		{
+			// no early out, the compiler can vectorize this
+			uint64_t missing = 0;
+			for (size_t i = 0; i < TWords; i++)
+				missing |= o.m_words[i] & ~m_words[i];
+			return missing == 0;
+		}
+		bool intersects(const ComponentMask& o) const noexcept
+		{
+			uint64_t common = 0;
+			for (size_t i = 0; i < TWords; i++)
+				common |= o.m_words[i] & m_words[i];
+			return common != 0;
+		}
+		ComponentMask& operator|=(const ComponentMask& o) noexcept
+		{
+			for (size_t i = 0; i < TWords; i++)
+				m_words[i] |= o.m_words[i];
+			return *this;
+		}
+		ComponentMask& operator&=(const ComponentMask& o) noexcept
+		{
+			for (size_t i = 0; i < TWords; i++)
+				m_words[i] &= o.m_words[i];
+			return *this;
+		}
+		ComponentMask operator|(const ComponentMask& o) const noexcept
+		{
+			ComponentMask res = *this;
+			return res |= o;
+		}
+		ComponentMask operator&(const ComponentMask& o) const noexcept
+		{
+			ComponentMask res = *this;
+			return res &= o;
+		}
+		bool operator==(const ComponentMask& o) const noexcept
+		{
+			uint64_t diff = 0;
+			for (size_t i = 0; i < TWords; i++)
+				diff |= o.m_words[i] ^ m_words[i];
+			return diff == 0;
+		}
+		bool operator!=(const ComponentMask& o) const noexcept
+		{
+			return !(*this == o);
+		}
+		uint64_t word(size_t i) const noexcept
+		{
+			assert(i < TWords);
+			return m_words[i];
+		}
+		void setWord(size_t i, uint64_t w) noexcept
+		{
+			assert(i < TWords);
+			m_words[i] = w;
+		}
+		size_t hash() const noexcept
+		{
+			size_t h = 0;
+			for (size_t i = 0; i < TWords; i++)
+				h = h * 31 + std::hash<uint64_t>()(m_words[i]);
+			return h;
+		}
+		struct Hash
+		{
+			size_t operator()(const ComponentMask& m) const noexcept
+			{
+				return m.hash();
+			}
+		};
+		static constexpr size_t s_words = TWords;
 	private:
-		ManagerT* m_manager = nullptr;
+		template<size_t... TWordIndices, typename... TIndices>
+		constexpr ComponentMask(IndexSequence<TWordIndices...>, TIndices... indices) noexcept
+			:
+		m_words{ componentMaskWord(TWordIndices, indices...)... }
+		{}
+	private:
+		uint64_t m_words[TWords];
 	};
 
-	template<typename... TComponents>
-	class Entity
+	// up to 64 components: a single integer
+	template<>
+	class ComponentMask<1>
 	{
 	public:
-		using ManagerT = Manager<TComponents...>;
-		using ScriptT = Script<TComponents...>;
-		friend ManagerT;
-
-		void kill() noexcept
-		{
-			m_alive = false;
-		}
-		bool isAlive() const noexcept
+		constexpr ComponentMask() noexcept
+			:
+		m_word(0)
+		{}
+		template<typename... TIndices>
+		static constexpr ComponentMask fromIndices(TIndices... indices) noexcept
 		{
-			return m_alive;
+			return ComponentMask(componentMaskWord(0, indices...));
 		}
-		size_t getID() const
+		static ComponentMask bit(size_t index) noexcept
 		{
-			return m_id;
+			return ComponentMask(uint64_t(1) << index);
 		}
-		template<class T>
-		T& addComponent()
+		void set(size_t index) noexcept
 		{
-			assert(!m_componentsAdded);
-			static const size_t slot = m_manager->template getComponentIndex<T>();
-			m_componentFlags |= SystemKeyT(1) << SystemKeyT(slot);
-			return getComponent<T>();
+			m_word |= uint64_t(1) << index;
 		}
-		template<class T>
-		bool hasComponent() const
+		void reset(size_t index) noexcept
 		{
-			return ((SystemKeyT(1) << (m_manager->template getComponentIndex<T>())) & m_componentFlags) != 0;
+			m_word &= ~(uint64_t(1) << index);
 		}
-		template<typename... TReq>
-		bool hasComponents() const
+		bool test(size_t index) const noexcept
 		{
-			return (m_componentFlags & ManagerT::getComponentMask(0, std::tuple<TReq...>())) == ManagerT::getComponentMask(0, std::tuple<TReq...>());
+			return (m_word & (uint64_t(1) << index)) != 0;
 		}
-#ifndef _MSC_BUILD
-		template<class T>
-		T& getComponent()
+		bool none() const noexcept
 		{
-			assert(hasComponent<T>());
-			return std::get<ManagerT::template getComponentIndex<T>()>(m_components);
+			return m_word == 0;
 		}
-		template<class T>
-		const T& getComponent() const
+		bool contains(const ComponentMask& o) const noexcept
 		{
-			assert(hasComponent<T>());
-			return std::get<ManagerT::template getComponentIndex<T>()>(m_components);
+			return (m_word & o.m_word) == o.m_word;
 		}
-#else
-		template<class T>
-		T& getComponent()
+		bool intersects(const ComponentMask& o) const noexcept
 		{
-			assert(hasComponent<T>());
-			return _getComponent<T>(m_components);
+			return (m_word & o.m_word) != 0;
 		}
-		template<class T>
-		const T& getComponent() const
+		ComponentMask& operator|=(const ComponentMask& o) noexcept
 		{
-			assert(hasComponent<T>());
-			return _getComponent<T>(m_components);
+			m_word |= o.m_word;
+			return *this;
 		}
-#endif
-		void addScript(shared_ptr<ScriptT> s)
+		ComponentMask& operator&=(const ComponentMask& o) noexcept
 		{
-			assert(!m_componentsAdded);
-			assert(s);
-			assert(m_manager);
-			s->m_manager = m_manager;
-			s->m_curEntity = this;
-			m_scripts.push_back(s);
+			m_word &= o.m_word;
+			return *this;
 		}
-		ManagerT& getManager() const
+		ComponentMask operator|(const ComponentMask& o) const noexcept
 		{
-			assert(m_manager);
-			return *m_manager;
+			return ComponentMask(m_word | o.m_word);
 		}
-	private:
-#ifdef _MSC_BUILD
-		template<typename  T, typename... TComps>
-		static constexpr T& _getComponent(std::tuple<T, TComps...>& t)
+		ComponentMask operator&(const ComponentMask& o) const noexcept
 		{
-			return std::get<0>(t);
+			return ComponentMask(m_word & o.m_word);
 		}
-		template<typename  T, typename... TComps>
-		static constexpr T& _getComponent(std::tuple<TComps...>& t)
+		bool operator==(const ComponentMask& o) const noexcept
 		{
-			return _getComponent<T>(t._Get_rest());
+			return m_word == o.m_word;
 		}
-		template<typename T>
-		static constexpr T& _getComponent(std::tuple<>&)
+		bool operator!=(const ComponentMask& o) const noexcept
 		{
-			// ReSharper disable once CppStaticAssertFailure
-			static_assert(false, "component type does not exist in this system");
-			return *reinterpret_cast<T*>(nullptr);
+			return m_word != o.m_word;
 		}
-		template<typename  T, typename... TComps>
-		static constexpr const T& _getComponent(const std::tuple<T, TComps...>& t)
+		uint64_t word(size_t i) const noexcept
 		{
-			return std::get<0>(t);
+			assert(i == 0);
+			return m_word;
 		}
-		template<typename  T, typename... TComps>
-		static constexpr const T& _getComponent(const std::tuple<TComps...>& t)
+		void setWord(size_t i, uint64_t w) noexcept
 		{
-			return _getComponent<T>(t._Get_rest());
+			assert(i == 0);
+			m_word = w;
 		}
-		template<typename T>
-		static constexpr const T& _getComponent(const std::tuple<>&)
+		size_t hash() const noexcept
 		{
-			// ReSharper disable once CppStaticAssertFailure
-			static_assert(false, "component type does not exist in this system");
-			return *reinterpret_cast<T*>(nullptr);
+			return std::hash<uint64_t>()(m_word);
 		}
-#endif
-		void runScript(float dt)
+		struct Hash
 		{
-			assert(hasScript());
-			for (auto s : m_scripts)
+			size_t operator()(const ComponentMask& m) const noexcept
 			{
-				s->m_curEntity = this;
-				s->tick(dt);
-				//s->m_curEntity = nullptr;
+				return m.hash();
 			}
+		};
+		static constexpr size_t s_words = 1;
+	private:
+		explicit constexpr ComponentMask(uint64_t w) noexcept
+			:
+		m_word(w)
+		{}
+	private:
+		uint64_t m_word;
+	};
+
+	/*
+	weak reference to an entity of a manager.
+	the handle becomes invalid once the entity was removed, even if its slot is reused by a new entity
+	*/
+	struct EntityHandle
+	{
+		EntityHandle() = default;
+		EntityHandle(uint32_t i, uint32_t g)
+			:
+		index(i),
+		generation(g)
+		{}
+		bool operator==(const EntityHandle& o) const noexcept
+		{
+			return index == o.index && generation == o.generation;
 		}
-		void runStartupScript()
+		bool operator!=(const EntityHandle& o) const noexcept
 		{
-			if (hasScript())
-			{
-				for (auto s : m_scripts)
-				{
-					s->m_curEntity = this;
-					s->begin();
-					//s->m_curEntity = nullptr;
-				}
-			}
+			return !(*this == o);
 		}
-		bool hasScript() const
+
+		uint32_t index = uint32_t(-1);
+		uint32_t generation = 0;
+	};
+
+	/*
+	memory source for the entity storage of a manager (see Manager::setAllocator)
+	*/
+	class Allocator
+	{
+	public:
+		virtual ~Allocator() = default;
+		virtual void* allocate(size_t bytes, size_t alignment) = 0;
+		virtual void deallocate(void* p, size_t bytes, size_t alignment) = 0;
+	};
+
+	class DefaultAllocator : public Allocator
+	{
+	public:
+		void* allocate(size_t bytes, size_t alignment) override
 		{
-			return m_scripts.size() != 0;
+			// the original pointer is stored in front of the aligned memory
+			alignment = std::max(alignment, alignof(void*));
+			char* raw = static_cast<char*>(::operator new(bytes + alignment + sizeof(void*)));
+			const uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1) & ~uintptr_t(alignment - 1);
+			reinterpret_cast<void**>(aligned)[-1] = raw;
+			return reinterpret_cast<void*>(aligned);
+		}
+		void deallocate(void* p, size_t, size_t) override
+		{
+			if (p)
+				::operator delete(static_cast<void**>(p)[-1]);
 		}
-	private:
-		bool m_alive = true;
-		bool m_componentsAdded = false;
-		size_t m_id = -1;
-		ManagerT* m_manager = nullptr;
-		std::tuple<TComponents...> m_components;
-		SystemKeyT m_componentFlags = 0; // bitflag of used components
-		static_assert(std::tuple_size<std::tuple<TComponents...>>::value <= 64, "only up to 64 components are supported");
-		std::vector<shared_ptr<ScriptT>> m_scripts;
 	};
 
-	template<typename... TComponents>
-	class Manager
+	// initial capacities of the containers of a manager (see Manager(shared_ptr<ThreadPool>, const ManagerCapacity&))
+	struct ManagerCapacity
 	{
-		using TimeT = long long;
-		enum class States
+		// spawned entities
+		size_t entities = 1024;
+		// entities that are added within one tick
+		size_t freshEntities = 1024;
+		// entities of every query, a query reserves at least the number of entities at its creation
+		size_t queryEntities = 1024;
+		size_t queries = 64;
+	};
+
+	// memory of a manager in bytes (see Manager::memoryStats), every byte is counted once
+	struct MemoryStats
+	{
+		// components of the entities that have them, indexed like TComponents (including the sparse sets)
+		std::vector<size_t> components;
+		// tuple slots of components an entity does not have, or staged component tuples with ECS_ARCHETYPE_STORAGE
+		size_t unusedComponents = 0;
+		// entity objects (without components) and the bookkeeping of the manager
+		size_t entities = 0;
+		// entity lists of every query, in the order the queries were created
+		std::vector<size_t> queries;
+		// script pointers of the entities and the script groups
+		size_t scripts = 0;
+		// capacity of vectors and entity pages that is not used
+		size_t slack = 0;
+
+		size_t total() const noexcept
 		{
-			Init,
-			Running
-		};
+			size_t res = unusedComponents + entities + scripts + slack;
+			for (auto c : components)
+				res += c;
+			for (auto q : queries)
+				res += q;
+			return res;
+		}
+	};
+
+#ifdef ECS_ARCHETYPE_STORAGE
+#ifndef ECS_COLUMN_ALIGNMENT
+	// alignment (in bytes) of the component arrays of an archetype
+#define ECS_COLUMN_ALIGNMENT 64
+#endif
+	// allocator for the component arrays of an archetype
+	template<class T>
+	class ColumnAllocator
+	{
 	public:
-		using EntityT = Entity<TComponents...>;
-		using SystemT = System<TComponents...>;
-		friend Entity<TComponents...>;
+		using value_type = T;
+		static const size_t alignment = ECS_COLUMN_ALIGNMENT > alignof(T) ? ECS_COLUMN_ALIGNMENT : alignof(T);
 
-		Manager()
+		ColumnAllocator() = default;
+		template<class U>
+		ColumnAllocator(const ColumnAllocator<U>&) noexcept {}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(DefaultAllocator().allocate(n * sizeof(T), alignment));
+		}
+		void deallocate(T* p, size_t n) noexcept
+		{
+			DefaultAllocator().deallocate(p, n * sizeof(T), alignment);
+		}
+		template<class U>
+		bool operator==(const ColumnAllocator<U>&) const noexcept
+		{
+			return true;
+		}
+		template<class U>
+		bool operator!=(const ColumnAllocator<U>&) const noexcept
+		{
+			return false;
+		}
+	};
+	template<class T>
+	using ColumnT = std::vector<T, ColumnAllocator<T>>;
+#endif
+
+	/*
+	storage policy of a component type. specialize it for components that are added and removed often:
+	template<> struct ecs::SparseStorage<Selected> : std::true_type {};
+	sparse components are kept by the manager in a sparse set, adding or removing them does not change the queries of the entity
+	*/
+	template<class T>
+	struct SparseStorage : std::false_type
+	{};
+
+	// true if one of Ts uses sparse storage
+	template<typename... Ts>
+	struct HasSparseStorage : std::false_type
+	{};
+	template<typename T, typename... Ts>
+	struct HasSparseStorage<T, Ts...> : std::integral_constant<bool,
+		SparseStorage<typename std::remove_const<T>::type>::value || HasSparseStorage<Ts...>::value>
+	{};
+
+	/*
+	opt-in change detection of a component type: template<> struct ecs::TrackChanges<Transform> : std::true_type {};
+	every entity stores the version of its last mutable access to the component (see Manager::forEachChanged)
+	*/
+	template<class T>
+	struct TrackChanges : std::false_type
+	{};
+
+	// number of Ts with change detection
+	template<typename... Ts>
+	struct TrackedCount : std::integral_constant<size_t, 0>
+	{};
+	template<typename T, typename... Ts>
+	struct TrackedCount<T, Ts...> : std::integral_constant<size_t,
+		(TrackChanges<T>::value ? 1 : 0) + TrackedCount<Ts...>::value>
+	{};
+
+	// position of the I-th of Ts within the Ts with change detection
+	template<size_t I, typename... Ts>
+	struct TrackedIndex : std::integral_constant<size_t, 0>
+	{};
+	template<size_t I, typename T, typename... Ts>
+	struct TrackedIndex<I, T, Ts...> : std::integral_constant<size_t,
+		(TrackChanges<T>::value ? 1 : 0) + TrackedIndex<I - 1, Ts...>::value>
+	{};
+	template<typename T, typename... Ts>
+	struct TrackedIndex<0, T, Ts...> : std::integral_constant<size_t, 0>
+	{};
+
+	// true if one of Ts is a non const component with change detection
+	template<typename... Ts>
+	struct HasMutableTracked : std::false_type
+	{};
+	template<typename T, typename... Ts>
+	struct HasMutableTracked<T, Ts...> : std::integral_constant<bool,
+		(!std::is_const<T>::value && TrackChanges<typename std::remove_const<T>::type>::value) || HasMutableTracked<Ts...>::value>
+	{};
+
+	template<typename... TComponents>
+	class Manager;
+
+	template<typename... TComponents>
+	class Entity;
+
+#ifdef ECS_ARCHETYPE_STORAGE
+	template<typename... TComponents>
+	class Archetype;
+#endif
+
+	template<typename... TComponents>
+	class CommandBuffer;
+
+	template<typename... TComponents>
+	class QueryFrame;
+
+	template<typename... TComponents>
+	class PublishedQuery;
+
+	enum class ParallelSchedule
+	{
+		// one equal range per thread
+		Static,
+		// small chunks, idle threads steal from busy threads
+		WorkStealing
+	};
+
+	// core and NUMA domain of a thread (see Manager::setThreadPlacement)
+	struct ThreadPlacement
+	{
+		size_t core = 0;
+		size_t domain = 0;
+	};
+
+	class WorldGroup;
+
+	/*
+	persistent worker threads for parallel execution.
+	workers are parked between jobs and the thread that calls run() executes tasks as well.
+	a pool can be shared by several managers (see WorldGroup)
+	*/
+	class ThreadPool
+	{
+	public:
+		friend WorldGroup;
+
+		explicit ThreadPool(size_t nWorkers = defaultWorkerCount())
+		{
+			m_workers.reserve(nWorkers);
+			for (size_t i = 0; i < nWorkers; i++)
+				m_workers.emplace_back([this, i]()
+				{
+					work(i + 1);
+				});
+
+			// measure time till the workers start for parallel execution
+			auto empty = [](size_t) {};
+			run(nWorkers + 1, empty);
+			auto start = std::chrono::high_resolution_clock::now();
+			run(nWorkers + 1, empty);
+			auto end = std::chrono::high_resolution_clock::now();
+			m_dispatchCost =
+				double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		}
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> g(m_mutex);
+				m_stop = true;
+			}
+			m_cvWork.notify_all();
+			for (auto& t : m_workers)
+				t.join();
+		}
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// number of background threads (without the calling thread)
+		size_t getWorkerCount() const noexcept
+		{
+			return m_workers.size();
+		}
+		static size_t defaultWorkerCount() noexcept
+		{
+			// available Threads
+			size_t nThreads = std::thread::hardware_concurrency();
+			// its better for the system to run core-1 threads, so the system has one thread for itself
+			nThreads = nThreads > 3 ? nThreads - 1 : nThreads;
+			// the calling thread is one of the threads
+			return nThreads ? nThreads - 1 : 0;
+		}
+		// time in ns to wake up all workers, measured by the constructor
+		double getDispatchCost() const noexcept
+		{
+			return m_dispatchCost;
+		}
+		// 1 + worker number for threads of a pool, 0 for all other threads
+		static size_t getThreadIndex() noexcept
+		{
+			return threadIndex();
+		}
+		// true if the calling thread executes a task (of any pool), parallel loops within a task run on the calling thread
+		static bool insideTask() noexcept
+		{
+			return isInsideTask();
+		}
+		/*
+		true if other tasks of the same job may use the same manager at this time.
+		false within the tasks of a WorldGroup, every world is ticked by one thread
+		*/
+		static bool insideParallelTask() noexcept
+		{
+			return isInsideTask() && !isWorldThread();
+		}
+		/*
+		pins thread i to placement[i].core, thread 0 is the calling thread and thread i the i-th worker.
+		afterwards task i of a job always runs on thread i and threads steal work from their own domain first.
+		returns false if a thread could not be pinned (only implemented for linux), the domains are used anyway
+		*/
+		bool setPlacement(const std::vector<ThreadPlacement>& placement)
+		{
+			assert(placement.size() == m_workers.size() + 1);
+			assert(!isInsideTask());
+			std::lock_guard<std::mutex> dispatch(m_muDispatch);
+			bool pinned = true;
+			m_domains.resize(placement.size());
+			for (size_t i = 0; i < placement.size(); i++)
+			{
+				m_domains[i] = placement[i].domain;
+				pinned = pinThread(i, placement[i].core) && pinned;
+			}
+			m_fixed = true;
+			return pinned;
+		}
+		/*
+		executes func(i) for every i in [0, nTasks) and returns after all tasks are finished.
+		calls from within a task are executed on the calling thread
+		*/
+		template<typename TFunc>
+		void run(size_t nTasks, TFunc& func)
+		{
+			if (m_workers.empty() || nTasks < 2 || isInsideTask())
+			{
+				for (size_t i = 0; i < nTasks; i++)
+					func(i);
+				return;
+			}
+			// one job at a time
+			std::lock_guard<std::mutex> dispatch(m_muDispatch);
+			{
+				std::unique_lock<std::mutex> lk(m_mutex);
+				// workers might still hold the previous job
+				m_cvIdle.wait(lk, [this]()
+				{
+					return m_active == 0;
+				});
+				m_job = &invoke<TFunc>;
+				m_context = &func;
+				m_nTasks = nTasks;
+				// every thread runs the task with its own index
+				m_fixedJob = m_fixed && nTasks <= m_workers.size() + 1;
+				m_nextTask.store(0);
+				m_remaining.store(nTasks);
+				m_generation.fetch_add(1);
+			}
+			m_cvWork.notify_all();
+
+			isInsideTask() = true;
+			runTasks(m_job, m_context, nTasks, m_fixedJob, 0);
+			isInsideTask() = false;
+			// wait for tasks that were taken by workers
+			while (m_remaining.load(std::memory_order_acquire) != 0)
+				std::this_thread::yield();
+		}
+		/*
+		executes func(begin, end) for chunks of at most grainSize elements until [0, count) is processed.
+		every thread starts with an equal range and steals half of the remaining range of another thread when it runs out of work.
+		at most maxThreads threads (including the calling thread) take part, 0 uses all threads
+		*/
+		template<typename TFunc>
+		void runStealing(size_t count, size_t grainSize, TFunc& func, size_t maxThreads = 0)
+		{
+			assert(uint64_t(count) <= uint64_t(0xFFFFFFFF));
+			grainSize = grainSize ? grainSize : 1;
+			size_t nSlots = m_workers.size() + 1;
+			if (maxThreads && maxThreads < nSlots)
+				nSlots = maxThreads;
+			if (nSlots == 1 || count <= grainSize || isInsideTask())
+			{
+				for (size_t begin = 0; begin < count; begin += grainSize)
+					func(begin, std::min(begin + grainSize, count));
+				return;
+			}
+
+			std::vector<StealRange> ranges(nSlots);
+			const size_t step = count / nSlots;
+			for (size_t i = 0; i < nSlots; i++)
+				ranges[i].range.store(packRange(i * step, i == nSlots - 1 ? count : (i + 1) * step));
+
+			// the slots only match the threads if the tasks are fixed to the threads
+			const size_t* domains = m_fixed ? m_domains.data() : nullptr;
+			auto task = [&ranges, nSlots, grainSize, &func, domains](size_t self)
+			{
+				size_t begin, end;
+				while (true)
+				{
+					if (popRange(ranges[self], grainSize, begin, end))
+						func(begin, end);
+					else if (!stealRange(ranges, self, grainSize, domains))
+						return;
+				}
+			};
+			run(nSlots, task);
+		}
+	private:
+		using JobT = void(*)(void*, size_t);
+		// [begin, end) packed into one word so it can be shrinked from both sides with compare exchange
+		struct StealRange
+		{
+			std::atomic<uint64_t> range{ 0 };
+			// keep ranges of different threads on different cache lines
+			char padding[64 - sizeof(std::atomic<uint64_t>)];
+		};
+
+		static uint64_t packRange(size_t begin, size_t end)
+		{
+			return (uint64_t(begin) << 32) | uint64_t(end);
+		}
+		// takes up to grainSize elements from the front of the own range
+		static bool popRange(StealRange& slot, size_t grainSize, size_t& begin, size_t& end)
+		{
+			uint64_t r = slot.range.load();
+			while (true)
+			{
+				const size_t b = size_t(r >> 32);
+				const size_t e = size_t(r & 0xFFFFFFFF);
+				if (b >= e)
+					return false;
+				const size_t n = std::min(grainSize, e - b);
+				if (slot.range.compare_exchange_weak(r, packRange(b + n, e)))
+				{
+					begin = b;
+					end = b + n;
+					return true;
+				}
+			}
+		}
+		/*
+		moves the back half of another range into the (empty) own range.
+		with domains the ranges of the own domain are tried first
+		*/
+		static bool stealRange(std::vector<StealRange>& ranges, size_t self, size_t grainSize, const size_t* domains)
+		{
+			const size_t nSlots = ranges.size();
+			for (int pass = domains ? 0 : 1; pass < 2; pass++)
+			{
+				for (size_t k = 1; k < nSlots; k++)
+				{
+					const size_t v = (self + k) % nSlots;
+					if (domains && (domains[v] == domains[self]) != (pass == 0))
+						continue;
+					StealRange& victim = ranges[v];
+					uint64_t r = victim.range.load();
+					while (true)
+					{
+						const size_t b = size_t(r >> 32);
+						const size_t e = size_t(r & 0xFFFFFFFF);
+						// the owner will finish small ranges on its own
+						if (b >= e || e - b <= grainSize)
+							break;
+						const size_t half = (e - b) / 2;
+						if (victim.range.compare_exchange_weak(r, packRange(b, e - half)))
+						{
+							ranges[self].range.store(packRange(e - half, e));
+							return true;
+						}
+					}
+				}
+			}
+			return false;
+		}
+
+		template<typename TFunc>
+		static void invoke(void* context, size_t i)
+		{
+			(*static_cast<TFunc*>(context))(i);
+		}
+		static size_t& threadIndex()
+		{
+			static thread_local size_t index = 0;
+			return index;
+		}
+		static bool& isInsideTask()
+		{
+			static thread_local bool inside = false;
+			return inside;
+		}
+		static bool& isWorldThread()
+		{
+			static thread_local bool world = false;
+			return world;
+		}
+		void runTasks(JobT job, void* context, size_t nTasks, bool fixed, size_t self)
+		{
+			if (fixed)
+			{
+				if (self < nTasks)
+				{
+					job(context, self);
+					m_remaining.fetch_sub(1, std::memory_order_release);
+				}
+				return;
+			}
+			size_t i;
+			while ((i = m_nextTask.fetch_add(1)) < nTasks)
+			{
+				job(context, i);
+				m_remaining.fetch_sub(1, std::memory_order_release);
+			}
+		}
+		void work(size_t index)
+		{
+			threadIndex() = index;
+			isInsideTask() = true;
+			size_t seen = 0;
+			while (true)
+			{
+				// spin for a short time before parking, jobs are usually dispatched in bursts
+				for (int spin = 0; spin < 64 && m_generation.load() == seen && !m_stop; spin++)
+					std::this_thread::yield();
+
+				std::unique_lock<std::mutex> lk(m_mutex);
+				m_cvWork.wait(lk, [this, seen]()
+				{
+					return m_stop || m_generation.load() != seen;
+				});
+				if (m_stop)
+					return;
+				seen = m_generation.load();
+				++m_active;
+				JobT job = m_job;
+				void* context = m_context;
+				size_t nTasks = m_nTasks;
+				bool fixed = m_fixedJob;
+				lk.unlock();
+
+				runTasks(job, context, nTasks, fixed, index);
+
+				lk.lock();
+				if (--m_active == 0)
+					m_cvIdle.notify_all();
+			}
+		}
+		bool pinThread(size_t index, size_t core)
+		{
+#ifdef __linux__
+			if (core >= CPU_SETSIZE)
+				return false;
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(core, &set);
+			const pthread_t thread = index ? m_workers[index - 1].native_handle() : pthread_self();
+			return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+			(void)index;
+			(void)core;
+			return false;
+#endif
+		}
+	private:
+		std::vector<std::thread> m_workers;
+		std::mutex m_muDispatch;
+		std::mutex m_mutex;
+		std::condition_variable m_cvWork;
+		std::condition_variable m_cvIdle;
+		// current job (guarded by m_mutex)
+		JobT m_job = nullptr;
+		void* m_context = nullptr;
+		size_t m_nTasks = 0;
+		bool m_fixedJob = false;
+		size_t m_active = 0;
+		// set by setPlacement(), domain of every thread index
+		bool m_fixed = false;
+		std::vector<size_t> m_domains;
+		std::atomic<size_t> m_generation{ 0 };
+		std::atomic<size_t> m_nextTask{ 0 };
+		std::atomic<size_t> m_remaining{ 0 };
+		std::atomic<bool> m_stop{ false };
+		double m_dispatchCost = 0.0;
+	};
+
+	/*
+	ticks several managers that share one ThreadPool at the same time, the managers may have different components.
+	every world is ticked by a single thread of the pool and its parallel loops run on that thread, so the cores are not oversubscribed.
+	worlds with a higher priority are started first, worlds with the same priority by the duration of their last tick (longest first)
+	*/
+	class WorldGroup
+	{
+		struct World
+		{
+			size_t id;
+			int priority;
+			std::function<void(float)> tick;
+			// duration of the last tick in ns
+			long long duration = 0;
+		};
+	public:
+		explicit WorldGroup(shared_ptr<ThreadPool> pool)
+			:
+		m_pool(std::move(pool))
+		{
+			assert(m_pool);
+		}
+		/*
+		the manager must be constructed with the pool of the group and started.
+		returns the id for setPriority() and remove(), the manager must be removed before it is destroyed
+		*/
+		template<class TManager>
+		size_t add(TManager& m, int priority = 0)
+		{
+			assert(m.getThreadPool().get() == m_pool.get() && "the manager must use the pool of the group");
+			World w;
+			w.id = m_nextID++;
+			w.priority = priority;
+			w.tick = [&m](float dt)
+			{
+				m.tick(dt);
+			};
+			m_worlds.push_back(std::move(w));
+			return m_worlds.back().id;
+		}
+		void setPriority(size_t id, int priority)
+		{
+			auto it = find(id);
+			assert(it != m_worlds.end() && "the world was already removed");
+			if (it != m_worlds.end())
+				it->priority = priority;
+		}
+		void remove(size_t id)
+		{
+			auto it = find(id);
+			assert(it != m_worlds.end() && "the world was already removed");
+			if (it != m_worlds.end())
+				m_worlds.erase(it);
+		}
+		size_t size() const noexcept
+		{
+			return m_worlds.size();
+		}
+		// ticks every world once and returns after all worlds are finished
+		void tick(float dt)
+		{
+			assert(!ThreadPool::insideTask());
+			m_order.resize(0);
+			for (auto& w : m_worlds)
+				m_order.push_back(&w);
+			std::stable_sort(m_order.begin(), m_order.end(), [](const World* a, const World* b)
+			{
+				if (a->priority != b->priority)
+					return a->priority > b->priority;
+				return a->duration > b->duration;
+			});
+			auto task = [this, dt](size_t i)
+			{
+				World& w = *m_order[i];
+				const bool wasWorld = ThreadPool::isWorldThread();
+				ThreadPool::isWorldThread() = true;
+				auto start = std::chrono::high_resolution_clock::now();
+				w.tick(dt);
+				w.duration = (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::high_resolution_clock::now() - start).count();
+				ThreadPool::isWorldThread() = wasWorld;
+			};
+			m_pool->run(m_order.size(), task);
+		}
+	private:
+		std::vector<World>::iterator find(size_t id)
+		{
+			return std::find_if(m_worlds.begin(), m_worlds.end(), [id](const World& w)
+			{
+				return w.id == id;
+			});
+		}
+	private:
+		shared_ptr<ThreadPool> m_pool;
+		std::vector<World> m_worlds;
+		std::vector<World*> m_order;
+		size_t m_nextID = 0;
+	};
+
+#ifdef ECS_PROFILER
+	/*
+	records the duration of the phases of Manager::tick (only compiled with ECS_PROFILER).
+	every thread of the worker pool records into its own list
+	*/
+	class Profiler
+	{
+	public:
+		struct Event
+		{
+			// static string or type name
+			const char* name;
+			// nanoseconds since the creation of the profiler
+			long long start;
+			long long duration;
+			// ThreadPool::getThreadIndex() of the recording thread
+			size_t thread;
+			// number of processed elements (entities, scripts or systems)
+			size_t count;
+			// true if the work was distributed between threads
+			bool parallel;
+		};
+
+		Profiler()
+			:
+		m_origin(std::chrono::high_resolution_clock::now())
+		{}
+		long long now() const
+		{
+			return (long long)(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - m_origin).count());
+		}
+		void record(const char* name, long long start, size_t count = 0, bool parallel = false)
+		{
+			const size_t thread = ThreadPool::getThreadIndex();
+			assert(thread < m_events.size());
+			Event e;
+			e.name = name;
+			e.start = start;
+			e.duration = now() - start;
+			e.thread = thread;
+			e.count = count;
+			e.parallel = parallel;
+			m_events[thread].push_back(e);
+		}
+		// events of all threads ordered by their start time
+		std::vector<Event> getEvents() const
+		{
+			std::vector<Event> res;
+			for (const auto& t : m_events)
+				res.insert(res.end(), t.begin(), t.end());
+			std::stable_sort(res.begin(), res.end(), [](const Event& l, const Event& r)
+			{
+				return l.start < r.start;
+			});
+			return res;
+		}
+		// must not be called during Manager::tick
+		void clear()
+		{
+			for (auto& t : m_events)
+				t.clear();
+		}
+		// json that can be opened with chrome://tracing or https://ui.perfetto.dev
+		void writeChromeTrace(std::ostream& os) const
+		{
+			os << "{\"traceEvents\":[";
+			bool first = true;
+			for (const auto& e : getEvents())
+			{
+				if (!first)
+					os << ',';
+				first = false;
+				os << "\n{\"name\":\"";
+				for (const char* c = e.name; *c; ++c)
+				{
+					if (*c == '"' || *c == '\\')
+						os << '\\';
+					os << *c;
+				}
+				os << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+					<< ",\"ts\":" << double(e.start) / 1000.0
+					<< ",\"dur\":" << double(e.duration) / 1000.0
+					<< ",\"args\":{\"count\":" << e.count
+					<< ",\"parallel\":" << (e.parallel ? "true" : "false") << "}}";
+			}
+			os << "\n]}\n";
+		}
+	private:
+		template<typename... TComponents>
+		friend class Manager;
+
+		void setThreadCount(size_t count)
+		{
+			m_events.resize(count);
+		}
+	private:
+		std::chrono::high_resolution_clock::time_point m_origin;
+		std::vector<std::vector<Event>> m_events;
+	};
+
+	// records the lifetime of the scope
+	class ProfileScope
+	{
+	public:
+		ProfileScope(Profiler& profiler, const char* name, size_t count = 0)
+			:
+		parallel(false),
+		m_profiler(profiler),
+		m_name(name),
+		m_count(count),
+		m_start(profiler.now())
+		{}
+		~ProfileScope()
+		{
+			m_profiler.record(m_name, m_start, m_count, parallel);
+		}
+		ProfileScope(const ProfileScope&) = delete;
+		ProfileScope& operator=(const ProfileScope&) = delete;
+
+		bool parallel;
+	private:
+		Profiler& m_profiler;
+		const char* m_name;
+		size_t m_count;
+		long long m_start;
+	};
+
+#define ECS_PROFILE_CONCAT_(a, b) a##b
+#define ECS_PROFILE_CONCAT(a, b) ECS_PROFILE_CONCAT_(a, b)
+// records the rest of the current scope into the m_profiler of the manager
+#define ECS_PROFILE_SCOPE(name, count) ecs::ProfileScope ECS_PROFILE_CONCAT(ecsProfileScope, __LINE__)(m_profiler, name, count)
+#else
+#define ECS_PROFILE_SCOPE(name, count) (void)0
+#endif
+
+	template<typename... TComponents>
+	class Script
+	{
+	public:
+		using EntityT = Entity<TComponents...>;
+		using ManagerT = Manager<TComponents...>;
+		friend EntityT;
+
+		virtual ~Script() = default;
+		// called on game start or spawn
+		virtual void begin() {}
+		// called every frame
+		virtual void tick(float dt) {}
+		/*
+		entity versions of begin() and tick().
+		the default implementations set the entity for getEntity() and call begin() or tick().
+		override them if the script instance is shared between entities
+		*/
+		virtual void beginEntity(EntityT& e)
+		{
+			m_curEntity = &e;
+			begin();
+		}
+		virtual void tickEntity(EntityT& e, float dt)
+		{
+			m_curEntity = &e;
+			tick(dt);
+		}
+		/*
+		scripts that return true may run tickEntity() for several entities at the same time (see Manager::setScriptBatching).
+		tickEntity() must be overridden and must not use getEntity()
+		*/
+		virtual bool isThreadSafe() const
+		{
+			return false;
+		}
+
+	protected:
+		EntityT& getEntity()
+		{
+			assert(m_curEntity);
+			return *m_curEntity;
+		}
+		const EntityT& getEntity() const
+		{
+			assert(m_curEntity);
+			return *m_curEntity;
+		}
+		ManagerT& getManager() const
+		{
+			assert(m_manager);
+			return *m_manager;
+		}
+	private:
+		EntityT* m_curEntity = nullptr;
+		ManagerT* m_manager = nullptr;
+	};
+
+	template<typename... TComponents>
+	class System
+	{
+	public:
+		using EntityT = Entity<TComponents...>;
+		using ManagerT = Manager<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend ManagerT;
+
+		virtual ~System() = default;
+
+		virtual void initQueries(ManagerT& m) {}
+		virtual void begin() {}
+		virtual void tick(float dt) {}
+		virtual void onEntitySpawn(EntityT& e) {}
+		virtual void onEntityDeath(EntityT& e) {}
+	protected:
+		ManagerT& getManager() const
+		{
+			assert(m_manager);
+			return *m_manager;
+		}
+		/*
+		declares the components that are read or written by tick() (call in initQueries).
+		systems with declared components may run at the same time as other systems that do not write the same components.
+		systems without a declaration run alone
+		*/
+		template<typename... T>
+		void reads()
+		{
+			m_declared = true;
+			m_reads = m_reads | ManagerT::template getComponentMask<T...>();
+		}
+		template<typename... T>
+		void writes()
+		{
+			m_declared = true;
+			m_writes = m_writes | ManagerT::template getComponentMask<T...>();
+		}
+		// declares the resources that are read or written by tick() (see Manager::addResource)
+		template<typename... T>
+		void readsResources()
+		{
+			m_declared = true;
+			m_resourceReads.insert(m_resourceReads.end(), { ManagerT::template getResourceIndex<T>()... });
+		}
+		template<typename... T>
+		void writesResources()
+		{
+			m_declared = true;
+			m_resourceWrites.insert(m_resourceWrites.end(), { ManagerT::template getResourceIndex<T>()... });
+		}
+	private:
+		bool conflicts(const System& o) const
+		{
+			if (!m_declared || !o.m_declared)
+				return true;
+			return m_writes.intersects(o.m_reads | o.m_writes) || o.m_writes.intersects(m_reads) ||
+				intersects(m_resourceWrites, o.m_resourceReads) || intersects(m_resourceWrites, o.m_resourceWrites) ||
+				intersects(o.m_resourceWrites, m_resourceReads);
+		}
+		// systems only use a few resources
+		static bool intersects(const std::vector<size_t>& a, const std::vector<size_t>& b)
+		{
+			for (auto i : a)
+			{
+				if (std::find(b.begin(), b.end(), i) != b.end())
+					return true;
+			}
+			return false;
+		}
+	private:
+		ManagerT* m_manager = nullptr;
+		bool m_declared = false;
+		SystemKeyT m_reads;
+		SystemKeyT m_writes;
+		// indices of the resources (see Manager::getResourceIndex)
+		std::vector<size_t> m_resourceReads;
+		std::vector<size_t> m_resourceWrites;
+	};
+
+	template<typename... TComponents>
+	class Entity
+	{
+	public:
+		using ManagerT = Manager<TComponents...>;
+		using ScriptT = Script<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend ManagerT;
+		friend CommandBuffer<TComponents...>;
+		friend QueryFrame<TComponents...>;
+#ifdef ECS_ARCHETYPE_STORAGE
+		using ArchetypeT = Archetype<TComponents...>;
+		friend ArchetypeT;
+#endif
+
+		// may be called from the threads of the manager (e.g. within forEachParallel), only the first call registers the entity
+		void kill() noexcept
+		{
+			if (!m_alive.exchange(false, std::memory_order_acq_rel))
+				return;
+			// entities that were not spawned yet are removed with the fresh entities
+			if (m_componentsAdded)
+				m_manager->registerKill(*this);
+		}
+		bool isAlive() const noexcept
+		{
+			return m_alive.load(std::memory_order_acquire);
+		}
+		size_t getID() const
+		{
+			return m_id;
+		}
+		EntityHandle getHandle() const noexcept
+		{
+			return m_handle;
+		}
+		/*
+		makes the entity a child of parent (nullptr detaches it), children are killed together with their parent.
+		the hierarchy changes immediately, it must not be changed from parallel code or within Manager::forEachHierarchical
+		*/
+		void setParent(Entity* parent)
+		{
+			m_manager->setParent(*this, parent);
+		}
+		// nullptr if the entity has no parent
+		Entity* getParent() const noexcept
+		{
+			return m_parent;
+		}
+		const std::vector<Entity*>& getChildren() const noexcept
+		{
+			return m_children;
+		}
+		// number of ancestors, 0 for entities without parent
+		size_t getDepth() const noexcept
+		{
+			return m_depth;
+		}
+		/*
+		components of spawned entities are added in the next Manager::tick, hasComponent() will return false until then.
+		the returned component can already be initialized. sparse components (see SparseStorage) are added immediately
+		*/
+		template<class T>
+		T& addComponent()
+		{
+			constexpr size_t slot = ManagerT::template getComponentIndex<T>();
+			auto lock = lockStructure();
+			if (!m_componentsAdded)
+			{
+				flagsOf<T>().set(slot);
+				return getComponent<T>();
+			}
+			markChanged<T>();
+			if (SparseStorage<T>::value)
+				return addSparseComponent<T>(slot);
+			if (m_componentFlags.test(slot))
+			{
+				// cancel a pending removal
+				if (m_migrating)
+					m_pendingFlags.set(slot);
+				return getComponentUnchecked<T>();
+			}
+			beginMigration();
+			m_pendingFlags.set(slot);
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(components()) = T();
+#else
+			return _getComponent<T>(components()) = T();
+#endif
+		}
+		// components of spawned entities are removed in the next Manager::tick (sparse components immediately)
+		template<class T>
+		void removeComponent()
+		{
+			constexpr size_t slot = ManagerT::template getComponentIndex<T>();
+			auto lock = lockStructure();
+			if (!m_componentsAdded)
+			{
+				if (flagsOf<T>().test(slot))
+					getComponent<T>() = T();
+				flagsOf<T>().reset(slot);
+				return;
+			}
+			if (SparseStorage<T>::value)
+			{
+				removeSparseComponent<T>(slot);
+				return;
+			}
+			if (!m_componentFlags.test(slot) && !m_migrating)
+				return;
+			beginMigration();
+			m_pendingFlags.reset(slot);
+		}
+		template<class T>
+		bool hasComponent() const
+		{
+			return flagsOf<T>().test(ManagerT::template getComponentIndex<T>());
+		}
+		template<typename... TReq>
+		bool hasComponents() const
+		{
+			return (m_componentFlags | m_sparseFlags).contains(ManagerT::template getComponentMask<TReq...>());
+		}
+		// marks the component as changed if T tracks changes (see TrackChanges), the const version does not
+		template<class T>
+		T& getComponent()
+		{
+			assert(hasComponent<T>());
+			markChanged<T>();
+			return getComponentUnchecked<T>();
+		}
+		template<class T>
+		const T& getComponent() const
+		{
+			assert(hasComponent<T>());
+			return getComponentUnchecked<T>();
+		}
+		// version of the last mutable access to T (see Manager::advanceChangeVersion), 0 before the entity was spawned
+		template<class T>
+		uint64_t getChangeVersion() const
+		{
+			static_assert(TrackChanges<T>::value, "the component does not track changes");
+			if (!m_componentsAdded)
+				return 0;
+			return m_manager->m_changeVersions[TrackedIndex<ManagerT::template getComponentIndex<T>(), TComponents...>::value][m_handle.index];
+		}
+		void addScript(shared_ptr<ScriptT> s)
+		{
+			assert(!m_componentsAdded);
+			assert(s);
+			assert(m_manager);
+			s->m_manager = m_manager;
+			s->m_curEntity = this;
+			m_scripts.push_back(s);
+		}
+		ManagerT& getManager() const
+		{
+			assert(m_manager);
+			return *m_manager;
+		}
+	private:
+		// component access without checks (the caller already knows that the component was added)
+		template<class T>
+		T& getComponentUnchecked()
+		{
+			if (SparseStorage<T>::value && m_componentsAdded)
+				return m_manager->template sparseSet<T>().get(m_handle.index);
+#ifdef ECS_ARCHETYPE_STORAGE
+			if (m_archetype)
+				return m_archetype->template column<T>()[m_row];
+#endif
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(components());
+#else
+			return _getComponent<T>(components());
+#endif
+		}
+		template<class T>
+		const T& getComponentUnchecked() const
+		{
+			if (SparseStorage<T>::value && m_componentsAdded)
+				return m_manager->template sparseSet<T>().get(m_handle.index);
+#ifdef ECS_ARCHETYPE_STORAGE
+			if (m_archetype)
+				return m_archetype->template column<T>()[m_row];
+#endif
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(components());
+#else
+			return _getComponent<T>(components());
+#endif
+		}
+#ifdef ECS_ARCHETYPE_STORAGE
+		// components added before the entity was moved into its archetype
+		std::tuple<TComponents...>& components()
+		{
+			assert(m_staging);
+			return *m_staging;
+		}
+		const std::tuple<TComponents...>& components() const
+		{
+			assert(m_staging);
+			return *m_staging;
+		}
+#else
+		std::tuple<TComponents...>& components()
+		{
+			return m_components;
+		}
+		const std::tuple<TComponents...>& components() const
+		{
+			return m_components;
+		}
+#endif
+#ifdef _MSC_BUILD
+		template<typename  T, typename... TComps>
+		static constexpr T& _getComponent(std::tuple<T, TComps...>& t)
+		{
+			return std::get<0>(t);
+		}
+		template<typename  T, typename... TComps>
+		static constexpr T& _getComponent(std::tuple<TComps...>& t)
+		{
+			return _getComponent<T>(t._Get_rest());
+		}
+		template<typename T>
+		static constexpr T& _getComponent(std::tuple<>&)
+		{
+			// ReSharper disable once CppStaticAssertFailure
+			static_assert(false, "component type does not exist in this system");
+			return *reinterpret_cast<T*>(nullptr);
+		}
+		template<typename  T, typename... TComps>
+		static constexpr const T& _getComponent(const std::tuple<T, TComps...>& t)
+		{
+			return std::get<0>(t);
+		}
+		template<typename  T, typename... TComps>
+		static constexpr const T& _getComponent(const std::tuple<TComps...>& t)
+		{
+			return _getComponent<T>(t._Get_rest());
+		}
+		template<typename T>
+		static constexpr const T& _getComponent(const std::tuple<>&)
+		{
+			// ReSharper disable once CppStaticAssertFailure
+			static_assert(false, "component type does not exist in this system");
+			return *reinterpret_cast<T*>(nullptr);
+		}
+#endif
+		// only spawned entities are marked, new entities are marked in Manager::tick
+		template<class T>
+		void markChanged()
+		{
+			markChanged<typename std::remove_const<T>::type>(std::integral_constant<bool,
+				!std::is_const<T>::value && TrackChanges<typename std::remove_const<T>::type>::value>());
+		}
+		template<class T>
+		void markChanged(std::true_type)
+		{
+			if (m_componentsAdded)
+				m_manager->m_changeVersions[TrackedIndex<ManagerT::template getComponentIndex<T>(), TComponents...>::value][m_handle.index] =
+					m_manager->m_changeVersion.load(std::memory_order_relaxed);
+		}
+		template<class T>
+		void markChanged(std::false_type)
+		{}
+		// m_sparseFlags or m_componentFlags
+		template<class T>
+		SystemKeyT& flagsOf() noexcept
+		{
+			return SparseStorage<T>::value ? m_sparseFlags : m_componentFlags;
+		}
+		template<class T>
+		const SystemKeyT& flagsOf() const noexcept
+		{
+			return SparseStorage<T>::value ? m_sparseFlags : m_componentFlags;
+		}
+		// splits the mask into the components of the entity and the sparse components
+		void setComponentFlags(const SystemKeyT& mask)
+		{
+			m_componentFlags = mask & ManagerT::getDenseMask();
+			m_sparseFlags = mask & ManagerT::getSparseMask();
+		}
+		/*
+		sparse components of spawned entities are added and removed immediately.
+		this is not synchronized, parallel code has to use the command buffer
+		*/
+		template<class T>
+		T& addSparseComponent(size_t slot)
+		{
+			assert(!ThreadPool::insideParallelTask() && "sparse components must be changed with the command buffer from parallel code");
+			auto& set = m_manager->template sparseSet<T>();
+			if (m_sparseFlags.test(slot))
+				return set.get(m_handle.index);
+			m_sparseFlags.set(slot);
+			m_manager->recordDelta(ManagerT::DeltaEvent::Migrated, *this);
+			return set.insert(m_handle.index, this, T());
+		}
+		template<class T>
+		void removeSparseComponent(size_t slot)
+		{
+			assert(!ThreadPool::insideParallelTask() && "sparse components must be changed with the command buffer from parallel code");
+			if (!m_sparseFlags.test(slot))
+				return;
+			m_sparseFlags.reset(slot);
+			m_manager->template sparseSet<T>().erase(m_handle.index);
+			m_manager->recordDelta(ManagerT::DeltaEvent::Migrated, *this);
+		}
+		/*
+		systems of the same parallel stage may add or remove components of the same entity,
+		their changes of the component flags and the migration state are serialized
+		*/
+		std::unique_lock<std::mutex> lockStructure() const
+		{
+			if (!m_manager || !m_manager->m_parallelSystems)
+				return std::unique_lock<std::mutex>();
+			return std::unique_lock<std::mutex>(m_manager->m_muStructure);
+		}
+		// the manager will apply m_pendingFlags
+		void beginMigration()
+		{
+			if (m_migrating)
+				return;
+			m_migrating = true;
+			m_pendingFlags = m_componentFlags;
+			m_manager->registerMigration(*this);
+		}
+		void runScript(float dt)
+		{
+			assert(hasScript());
+			for (auto& s : m_scripts)
+				s->tickEntity(*this, dt);
+		}
+		void runStartupScript()
+		{
+			if (hasScript())
+			{
+				for (auto& s : m_scripts)
+					s->beginEntity(*this);
+			}
+		}
+		bool hasScript() const
+		{
+			return m_scripts.size() != 0;
+		}
+	private:
+		std::atomic<bool> m_alive{ true };
+		bool m_componentsAdded = false;
+		size_t m_id = -1;
+		EntityHandle m_handle;
+		ManagerT* m_manager = nullptr;
+#ifdef ECS_ARCHETYPE_STORAGE
+		// staged components (only until the entity is moved into its archetype)
+		std::unique_ptr<std::tuple<TComponents...>> m_staging;
+		// location of the components after spawn
+		ArchetypeT* m_archetype = nullptr;
+		size_t m_row = 0;
+#else
+		std::tuple<TComponents...> m_components;
+#endif
+		SystemKeyT m_componentFlags; // bitflag of used components
+		// components with sparse storage (not part of m_componentFlags)
+		SystemKeyT m_sparseFlags;
+		std::vector<shared_ptr<ScriptT>> m_scripts;
+		// position in Manager::m_entities and Manager::m_scripted
+		size_t m_entityIndex = 0;
+		size_t m_scriptedIndex = 0;
+		// position in each query of the mask info (same order as MaskInfo::queries)
+		std::vector<size_t> m_queryPositions;
+		// components after the next tick (only valid if m_migrating is set)
+		SystemKeyT m_pendingFlags;
+		bool m_migrating = false;
+		// hierarchy (see Manager::forEachHierarchical)
+		Entity* m_parent = nullptr;
+		std::vector<Entity*> m_children;
+		size_t m_depth = 0;
+		// position in Manager::m_levels[m_depth - 1]
+		size_t m_levelIndex = 0;
+	};
+
+#ifdef ECS_ARCHETYPE_STORAGE
+	/*
+	stores the components of all entities that share the same component mask.
+	each component of the mask has its own contiguous array, a row index addresses one entity in all arrays
+	*/
+	template<typename... TComponents>
+	class Archetype
+	{
+	public:
+		using EntityT = Entity<TComponents...>;
+		using ManagerT = Manager<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend ManagerT;
+
+		explicit Archetype(SystemKeyT mask)
+			:
+		m_mask(mask)
+		{}
+		SystemKeyT getMask() const noexcept
+		{
+			return m_mask;
+		}
+		size_t size() const noexcept
+		{
+			return m_entities.size();
+		}
+		EntityT& getEntity(size_t row)
+		{
+			assert(row < m_entities.size());
+			return *m_entities[row];
+		}
+		const EntityT& getEntity(size_t row) const
+		{
+			assert(row < m_entities.size());
+			return *m_entities[row];
+		}
+		// contiguous array of one component type (row i belongs to getEntity(i))
+		template<class T>
+		ColumnT<T>& column()
+		{
+			assert(m_mask.test(ManagerT::template getComponentIndex<T>()));
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(m_columns);
+#else
+			return EntityT::template _getComponent<ColumnT<T>>(m_columns);
+#endif
+		}
+		template<class T>
+		const ColumnT<T>& column() const
+		{
+			assert(m_mask.test(ManagerT::template getComponentIndex<T>()));
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(m_columns);
+#else
+			return EntityT::template _getComponent<ColumnT<T>>(m_columns);
+#endif
+		}
+	private:
+		// moves the staged components of the entity into the arrays
+		void insert(EntityT& e)
+		{
+			assert(e.m_componentFlags == m_mask);
+			assert(!e.m_archetype);
+			e.m_archetype = this;
+			e.m_row = m_entities.size();
+			m_entities.push_back(&e);
+			pushRow<0>(e.components());
+		}
+		// adds a row without components, the manager appends them to the arrays (see Manager::loadSnapshot)
+		void insertEmpty(EntityT& e)
+		{
+			assert(e.m_componentFlags == m_mask);
+			assert(!e.m_archetype);
+			e.m_archetype = this;
+			e.m_row = m_entities.size();
+			m_entities.push_back(&e);
+		}
+		// removes the entity from the arrays by moving the last row into its place
+		void remove(EntityT& e)
+		{
+			assert(e.m_archetype == this);
+			const size_t row = e.m_row;
+			const size_t last = m_entities.size() - 1;
+			if (row != last)
+			{
+				m_entities[row] = m_entities[last];
+				m_entities[row]->m_row = row;
+			}
+			m_entities.pop_back();
+			removeRow<0>(row);
+			e.m_archetype = nullptr;
+		}
+		// moves the components of the row that are part of mask into dst
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type extractRow(size_t row, std::tuple<TComponents...>& dst, const SystemKeyT& mask)
+		{
+			if (m_mask.test(I) && mask.test(I))
+				std::get<I>(dst) = std::move(std::get<I>(m_columns)[row]);
+			extractRow<I + 1>(row, dst, mask);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type extractRow(size_t, std::tuple<TComponents...>&, const SystemKeyT&)
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type pushRow(std::tuple<TComponents...>& src)
+		{
+			if (m_mask.test(I))
+				std::get<I>(m_columns).push_back(std::move(std::get<I>(src)));
+			pushRow<I + 1>(src);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type pushRow(std::tuple<TComponents...>&)
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type removeRow(size_t row)
+		{
+			if (m_mask.test(I))
+			{
+				auto& c = std::get<I>(m_columns);
+				if (row != c.size() - 1)
+					c[row] = std::move(c.back());
+				c.pop_back();
+			}
+			removeRow<I + 1>(row);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type removeRow(size_t)
+		{}
+	private:
+		SystemKeyT m_mask;
+		std::vector<EntityT*> m_entities;
+		// only the arrays of components within m_mask are used
+		std::tuple<ColumnT<TComponents>...> m_columns;
+	};
+#endif
+
+	/*
+	components of one type with sparse storage (see SparseStorage), addressed by EntityHandle::index.
+	the components are packed into a dense array, a removed component is replaced by the last one
+	*/
+	template<class T, class TEntity>
+	class SparseSet
+	{
+	public:
+		size_t size() const noexcept
+		{
+			return m_values.size();
+		}
+		bool contains(uint32_t index) const noexcept
+		{
+			return index < m_sparse.size() && m_sparse[index] != s_none;
+		}
+		T& get(uint32_t index)
+		{
+			assert(contains(index));
+			return m_values[m_sparse[index]];
+		}
+		const T& get(uint32_t index) const
+		{
+			assert(contains(index));
+			return m_values[m_sparse[index]];
+		}
+		// dense access, value(i) belongs to getEntity(i)
+		T& value(size_t i)
+		{
+			assert(i < m_values.size());
+			return m_values[i];
+		}
+		const T& value(size_t i) const
+		{
+			assert(i < m_values.size());
+			return m_values[i];
+		}
+		TEntity& getEntity(size_t i) const
+		{
+			assert(i < m_entities.size());
+			return *m_entities[i];
+		}
+	private:
+		template<typename... TComponents>
+		friend class Manager;
+		template<typename... TComponents>
+		friend class Entity;
+
+		T& insert(uint32_t index, TEntity* e, T value)
+		{
+			assert(!contains(index));
+			if (index >= m_sparse.size())
+				m_sparse.resize(index + 1, s_none);
+			m_sparse[index] = uint32_t(m_values.size());
+			m_values.push_back(std::move(value));
+			m_entities.push_back(e);
+			return m_values.back();
+		}
+		void erase(uint32_t index)
+		{
+			assert(contains(index));
+			const uint32_t position = m_sparse[index];
+			const uint32_t last = uint32_t(m_values.size() - 1);
+			if (position != last)
+			{
+				m_values[position] = std::move(m_values[last]);
+				m_entities[position] = m_entities[last];
+				m_sparse[m_entities[position]->getHandle().index] = position;
+			}
+			m_values.pop_back();
+			m_entities.pop_back();
+			m_sparse[index] = s_none;
+		}
+		const std::vector<TEntity*>& entities() const noexcept
+		{
+			return m_entities;
+		}
+	private:
+		static const uint32_t s_none = uint32_t(-1);
+		std::vector<T> m_values;
+		std::vector<TEntity*> m_entities;
+		// position in m_values for every entity slot, s_none if the entity does not have the component
+		std::vector<uint32_t> m_sparse;
+	};
+	template<class T, class TEntity>
+	const uint32_t SparseSet<T, TEntity>::s_none;
+
+	// appends binary data to a buffer (see Manager::saveSnapshot)
+	class SnapshotWriter
+	{
+	public:
+		explicit SnapshotWriter(std::vector<char>& out)
+			:
+		m_out(out)
+		{}
+		void write(const void* data, size_t bytes)
+		{
+			const char* c = static_cast<const char*>(data);
+			m_out.insert(m_out.end(), c, c + bytes);
+		}
+		template<class T>
+		void write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be written directly");
+			write(&value, sizeof(T));
+		}
+		size_t size() const noexcept
+		{
+			return m_out.size();
+		}
+	private:
+		std::vector<char>& m_out;
+	};
+
+	/*
+	reads binary data from memory (e.g. a memory mapped file) without copying it first.
+	reading past the end fills the values with zeros and sets failed()
+	*/
+	class SnapshotReader
+	{
+	public:
+		SnapshotReader(const void* data, size_t size)
+			:
+		m_pos(static_cast<const char*>(data)),
+		m_end(static_cast<const char*>(data) + size)
+		{}
+		bool read(void* data, size_t bytes)
+		{
+			if (bytes > remaining())
+			{
+				std::memset(data, 0, bytes);
+				m_pos = m_end;
+				m_failed = true;
+				return false;
+			}
+			std::memcpy(data, m_pos, bytes);
+			m_pos += bytes;
+			return true;
+		}
+		template<class T>
+		bool read(T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be read directly");
+			return read(&value, sizeof(T));
+		}
+		// the next bytes of the data, nullptr if less than bytes are left
+		const char* skip(size_t bytes)
+		{
+			if (bytes > remaining())
+			{
+				m_pos = m_end;
+				m_failed = true;
+				return nullptr;
+			}
+			const char* res = m_pos;
+			m_pos += bytes;
+			return res;
+		}
+		size_t remaining() const noexcept
+		{
+			return size_t(m_end - m_pos);
+		}
+		bool failed() const noexcept
+		{
+			return m_failed;
+		}
+	private:
+		const char* m_pos;
+		const char* m_end;
+		bool m_failed = false;
+	};
+
+	/*
+	binary format of a component in snapshots, trivially copyable components are copied as they are.
+	specialize it for other components:
+	template<> struct ecs::Serializer<Name> { static void write(ecs::SnapshotWriter& w, const Name& v); static void read(ecs::SnapshotReader& r, Name& v); };
+	a specialization that always writes the same number of bytes may declare it as static constexpr size_t size, so columns are validated before loading
+	*/
+	template<class T>
+	struct Serializer
+	{
+		static constexpr size_t size = sizeof(T);
+		static void write(SnapshotWriter& w, const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "components that are not trivially copyable need a specialization of ecs::Serializer");
+			w.write(&value, sizeof(T));
+		}
+		static void read(SnapshotReader& r, T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "components that are not trivially copyable need a specialization of ecs::Serializer");
+			r.read(&value, sizeof(T));
+		}
+	};
+
+	// Serializer<T>::size or 0 if the serializer writes a variable number of bytes
+	template<class T>
+	struct SerializedSize
+	{
+		template<class U>
+		static std::integral_constant<size_t, U::size> test(int);
+		template<class U>
+		static std::integral_constant<size_t, 0> test(...);
+		static constexpr size_t value = decltype(test<Serializer<T>>(0))::value;
+	};
+
+	/*
+	records structural changes without locking. the commands are applied at the beginning of the next Manager::tick.
+	every thread of the worker pool has its own buffer (see Manager::getCommandBuffer)
+	*/
+	template<typename... TComponents>
+	class CommandBuffer
+	{
+	public:
+		using EntityT = Entity<TComponents...>;
+		using ManagerT = Manager<TComponents...>;
+		using ScriptT = Script<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend ManagerT;
+
+		// entity that will be added to the manager when the buffer is applied
+		class PendingEntity
+		{
+		public:
+			friend CommandBuffer;
+
+			template<class T>
+			T& addComponent()
+			{
+				auto& s = m_buffer->m_spawns[m_index];
+				s.mask.set(ManagerT::template getComponentIndex<T>());
+#ifndef _MSC_BUILD
+				return std::get<ManagerT::template getComponentIndex<T>()>(s.components);
+#else
+				return EntityT::template _getComponent<T>(s.components);
+#endif
+			}
+			void addScript(shared_ptr<ScriptT> s)
+			{
+				assert(s);
+				m_buffer->m_spawns[m_index].scripts.push_back(s);
+			}
+		private:
+			PendingEntity(CommandBuffer* buffer, size_t index)
+				:
+			m_buffer(buffer),
+			m_index(index)
+			{}
+			CommandBuffer* m_buffer;
+			size_t m_index;
+		};
+
+		PendingEntity spawn()
+		{
+			record(CommandType::Spawn, 0, m_spawns.size());
+			m_spawns.push_back(Spawn());
+			return PendingEntity(this, m_spawns.size() - 1);
+		}
+		void kill(EntityHandle h)
+		{
+			record(CommandType::Kill, 0, m_kills.size());
+			m_kills.push_back(h);
+		}
+		template<class T>
+		void addComponent(EntityHandle h, T component)
+		{
+			const size_t slot = ManagerT::template getComponentIndex<T>();
+#ifndef _MSC_BUILD
+			auto& v = std::get<ManagerT::template getComponentIndex<T>()>(m_components);
+#else
+			auto& v = EntityT::template _getComponent<std::vector<std::pair<EntityHandle, T>>>(m_components);
+#endif
+			record(CommandType::AddComponent, slot, v.size());
+			v.push_back(std::make_pair(h, std::move(component)));
+		}
+		template<class T>
+		void removeComponent(EntityHandle h)
+		{
+			record(CommandType::RemoveComponent, ManagerT::template getComponentIndex<T>(), m_removals.size());
+			m_removals.push_back(h);
+		}
+		// the entity must not be spawned yet
+		void addScript(EntityHandle h, shared_ptr<ScriptT> s)
+		{
+			assert(s);
+			record(CommandType::AddScript, 0, m_scripts.size());
+			m_scripts.push_back(std::make_pair(h, s));
+		}
+		bool empty() const noexcept
+		{
+			return m_commands.empty();
+		}
+	private:
+		enum class CommandType
+		{
+			Spawn,
+			Kill,
+			AddComponent,
+			RemoveComponent,
+			AddScript
+		};
+		struct Command
+		{
+			// the manager applies the commands of all buffers sorted by (batch, key)
+			uint64_t batch;
+			uint64_t key;
+			CommandType type;
+			// component index for AddComponent and RemoveComponent
+			size_t component;
+			// index into the vector of the command type
+			size_t index;
+		};
+		struct Spawn
+		{
+			std::tuple<TComponents...> components;
+			SystemKeyT mask;
+			std::vector<shared_ptr<ScriptT>> scripts;
+		};
+
+		void record(CommandType type, size_t component, size_t index)
+		{
+			Command c;
+			c.batch = m_batch;
+			c.key = m_key;
+			c.type = type;
+			c.component = component;
+			c.index = index;
+			m_commands.push_back(c);
+		}
+		void clear()
+		{
+			m_commands.clear();
+			m_spawns.clear();
+			m_kills.clear();
+			m_removals.clear();
+			m_scripts.clear();
+			clearComponents<0>();
+		}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type clearComponents()
+		{
+			std::get<I>(m_components).clear();
+			clearComponents<I + 1>();
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type clearComponents()
+		{}
+	private:
+		std::vector<Command> m_commands;
+		std::vector<Spawn> m_spawns;
+		std::vector<EntityHandle> m_kills;
+		std::vector<EntityHandle> m_removals;
+		std::vector<std::pair<EntityHandle, shared_ptr<ScriptT>>> m_scripts;
+		std::tuple<std::vector<std::pair<EntityHandle, TComponents>>...> m_components;
+		// set by the manager: batch changes with every parallel call, key is the first entity of the processed range
+		uint64_t m_batch = 0;
+		uint64_t m_key = 0;
+	};
+
+	/*
+	copy of a query at the end of a Manager::tick: the handles, IDs and the requested components of all entities.
+	the frame does not change while it is read (see Manager::readQuery)
+	*/
+	template<typename... TComponents>
+	class QueryFrame
+	{
+	public:
+		using ManagerT = Manager<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend ManagerT;
+		friend PublishedQuery<TComponents...>;
+
+		size_t size() const noexcept
+		{
+			return m_handles.size();
+		}
+		// number of the tick that was copied, 0 before the first tick
+		uint64_t getTick() const noexcept
+		{
+			return m_tick;
+		}
+		const std::vector<EntityHandle>& getHandles() const noexcept
+		{
+			return m_handles;
+		}
+		const std::vector<size_t>& getIDs() const noexcept
+		{
+			return m_ids;
+		}
+		// component of entity i is getColumn<T>()[i], only the components of the query are copied
+		template<class T>
+		const std::vector<T>& getColumn() const
+		{
+			assert(m_key.test(ManagerT::template getComponentIndex<T>()));
+#ifndef _MSC_BUILD
+			return std::get<ManagerT::template getComponentIndex<T>()>(m_columns);
+#else
+			return Entity<TComponents...>::template _getComponent<std::vector<T>>(m_columns);
+#endif
+		}
+	private:
+		SystemKeyT m_key;
+		uint64_t m_tick = 0;
+		std::vector<EntityHandle> m_handles;
+		std::vector<size_t> m_ids;
+		std::tuple<std::vector<TComponents>...> m_columns;
+	};
+
+	/*
+	three frames of a query: the manager writes a frame that nobody reads and publishes it with one atomic store.
+	readers count themselves on the published frame, so they never wait for the manager
+	*/
+	template<typename... TComponents>
+	class PublishedQuery
+	{
+	public:
+		using FrameT = QueryFrame<TComponents...>;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		friend Manager<TComponents...>;
+
+		explicit PublishedQuery(SystemKeyT key)
+		{
+			for (size_t i = 0; i < s_frames; i++)
+			{
+				m_frames[i].m_key = key;
+				m_readers[i].store(0);
+			}
+		}
+		SystemKeyT getKey() const noexcept
+		{
+			return m_frames[0].m_key;
+		}
+		// index of the published frame, its reader count is already incremented
+		uint32_t acquire()
+		{
+			for (;;)
+			{
+				const uint32_t i = m_current.load();
+				m_readers[i].fetch_add(1);
+				// the frame may have been reused between the load and the increment
+				if (m_current.load() == i)
+					return i;
+				m_readers[i].fetch_sub(1);
+			}
+		}
+		void release(uint32_t i)
+		{
+			m_readers[i].fetch_sub(1);
+		}
+		const FrameT& frame(uint32_t i) const
+		{
+			return m_frames[i];
+		}
+	private:
+		// a frame without readers, nullptr if all frames are read (the old frame stays published)
+		FrameT* beginPublish()
+		{
+			const uint32_t current = m_current.load();
+			for (uint32_t i = 0; i < s_frames; i++)
+			{
+				if (i != current && m_readers[i].load() == 0)
+				{
+					m_writing = i;
+					return &m_frames[i];
+				}
+			}
+			return nullptr;
+		}
+		void endPublish()
+		{
+			m_current.store(m_writing);
+		}
+		static const uint32_t s_frames = 3;
+		FrameT m_frames[s_frames];
+		std::atomic<uint32_t> m_readers[s_frames];
+		std::atomic<uint32_t> m_current{ 0 };
+		uint32_t m_writing = 0;
+	};
+
+	// read access to the published frame of a query, the frame is not reused until the view is destroyed
+	template<typename... TComponents>
+	class QueryView
+	{
+	public:
+		using FrameT = QueryFrame<TComponents...>;
+		friend Manager<TComponents...>;
+
+		QueryView(QueryView&& o) noexcept
+			:
+		m_query(o.m_query),
+		m_index(o.m_index)
+		{
+			o.m_query = nullptr;
+		}
+		QueryView(const QueryView&) = delete;
+		QueryView& operator=(const QueryView&) = delete;
+		~QueryView()
+		{
+			if (m_query)
+				m_query->release(m_index);
+		}
+		const FrameT& operator*() const
+		{
+			return m_query->frame(m_index);
+		}
+		const FrameT* operator->() const
+		{
+			return &m_query->frame(m_index);
+		}
+	private:
+		explicit QueryView(PublishedQuery<TComponents...>& q)
+			:
+		m_query(&q),
+		m_index(q.acquire())
+		{}
+		PublishedQuery<TComponents...>* m_query;
+		uint32_t m_index;
+	};
+
+	template<typename... TComponents>
+	class Manager
+	{
+		static_assert(UniqueTypes<TComponents...>::value, "component types must be unique");
+		using TimeT = long long;
+		using SystemKeyT = ComponentMask<componentMaskWords(sizeof...(TComponents))>;
+		enum class States
+		{
+			Init,
+			Running
+		};
+		enum class DeltaEvent
+		{
+			Spawned,
+			Killed,
+			Migrated // components were added or removed
+		};
+		// entry of the history for saveDelta(), ordered by version
+		struct DeltaRecord
+		{
+			uint64_t version;
+			uint64_t id;
+			EntityHandle handle;
+			DeltaEvent event;
+		};
+		// entities of a snapshot or delta that were validated by readEntities()
+		struct EntityTable
+		{
+			const char* records = nullptr;
+			size_t count = 0;
+			uint64_t nextID = 0;
+			std::vector<SnapshotReader> columns;
+		};
+		// changed values of one component in a delta
+		struct DeltaColumn
+		{
+			DeltaColumn()
+				:
+			values(nullptr, 0)
+			{}
+			const char* ids = nullptr;
+			size_t count = 0;
+			SnapshotReader values;
+		};
+		struct Query
+		{
+			explicit Query(SystemKeyT k)
+				:
+			key(k)
+			{}
+			SystemKeyT key;
+			// position in m_queries. MaskInfo::queries are ordered by this index
+			size_t index = 0;
+			std::vector<Entity<TComponents...>*> entities;
+			// index of this query in the MaskInfo::queries of the entity with the same position
+			std::vector<size_t> refs;
+#ifdef ECS_ARCHETYPE_STORAGE
+			// archetypes that contain all components of the key
+			std::vector<Archetype<TComponents...>*> archetypes;
+#endif
+		};
+		// value of addResource() behind a type erased pointer
+		struct ResourceBase
+		{
+			virtual ~ResourceBase() = default;
+		};
+		template<class T>
+		struct Resource : ResourceBase
+		{
+			template<typename... TArgs>
+			explicit Resource(TArgs&&... args)
+				:
+			value(std::forward<TArgs>(args)...)
+			{}
+			T value;
+		};
+		// smoothed timing history of one parallel loop (see parallelFor)
+		struct CostHistory
+		{
+			// estimated time per element in ns, 0 before the first call
+			double costPerElement = 0.0;
+			// threads that were used by the last call
+			size_t threads = 1;
+		};
+		// cached information about one component combination of spawned entities
+		struct MaskInfo
+		{
+			// all queries that match the mask
+			std::vector<Query*> queries;
+#ifdef ECS_ARCHETYPE_STORAGE
+			Archetype<TComponents...>* archetype = nullptr;
+#endif
+		};
+	public:
+		using EntityT = Entity<TComponents...>;
+		using SystemT = System<TComponents...>;
+		using ScriptT = Script<TComponents...>;
+		using CommandBufferT = CommandBuffer<TComponents...>;
+		using QueryViewT = QueryView<TComponents...>;
+		friend Entity<TComponents...>;
+		friend CommandBufferT;
+		friend SystemT;
+		friend QueryFrame<TComponents...>;
+#ifdef ECS_ARCHETYPE_STORAGE
+		using ArchetypeT = Archetype<TComponents...>;
+		friend ArchetypeT;
+#endif
+
+		Manager()
+			:
+		Manager(make_shared<ThreadPool>())
+		{}
+		explicit Manager(const ManagerCapacity& capacity)
+			:
+		Manager(make_shared<ThreadPool>(), capacity)
+		{}
+		// the pool can be shared with other managers (see WorldGroup)
+		explicit Manager(shared_ptr<ThreadPool> pool, const ManagerCapacity& capacity = ManagerCapacity())
+			:
+		m_capacity(capacity),
+		m_pool(std::move(pool))
+		{
+			assert(m_pool);
+			m_entities.reserve(capacity.entities);
+			m_queries.reserve(capacity.queries);
+			m_freshEntities.reserve(capacity.freshEntities);
+			m_slots.reserve(capacity.entities);
+#ifdef ECS_ARCHETYPE_STORAGE
+			m_archetypes.reserve(64);
+#endif
+
+			// the calling thread is one of the m_nThreads
+			m_nThreads = m_pool->getWorkerCount() + 1;
+			// one command buffer per thread of the pool
+			for (size_t i = 0; i < m_nThreads; i++)
+				m_commandBuffers.push_back(std::unique_ptr<CommandBufferT>(new CommandBufferT()));
+			m_killed.resize(m_nThreads);
+			m_migrations.resize(m_nThreads);
+#ifdef ECS_PROFILER
+			m_profiler.setThreadCount(m_nThreads);
+#endif
+			m_allocator = make_shared<DefaultAllocator>();
+			m_dispatchCost = m_pool->getDispatchCost();
+		}
+		~Manager()
+		{
+			for (auto& slot : m_slots)
+				if (slot.entity)
+					slot.entity->~EntityT();
+			for (auto page : m_pages)
+				if (page)
+					m_allocator->deallocate(page, sizeof(EntityT) * s_entitiesPerPage, alignof(EntityT));
+		}
+		Manager(const Manager&) = delete;
+		Manager& operator=(const Manager&) = delete;
+		/*
+		sets the allocator for the entity storage. 
+		entities are allocated in pages and the memory of removed entities is reused
+		*/
+		void setAllocator(shared_ptr<Allocator> allocator)
+		{
+			assert(m_state == States::Init);
+			assert(allocator);
+			assert(m_pages.empty());
+			m_allocator = allocator;
+		}
+		/*
+		bytes used by the entities, components, queries and scripts of the manager.
+		visits every entity slot, so it should not be called every frame
+		*/
+		MemoryStats memoryStats() const
+		{
+			assert(!ThreadPool::insideParallelTask() && !m_parallelSystems);
+			MemoryStats s;
+			s.components.resize(sizeof...(TComponents), 0);
+			countVector(m_slots, s.entities, s);
+			countVector(m_freeSlots, s.entities, s);
+			countVector(m_pages, s.entities, s);
+			for (size_t p = 0; p < m_pages.size(); p++)
+			{
+				if (!m_pages[p])
+					continue;
+				for (size_t i = p * s_entitiesPerPage; i < (p + 1) * s_entitiesPerPage; i++)
+				{
+					const EntityT* e = i < m_slots.size() ? m_slots[i].entity : nullptr;
+					if (!e)
+					{
+						s.slack += sizeof(EntityT);
+						continue;
+					}
+#ifdef ECS_ARCHETYPE_STORAGE
+					s.entities += sizeof(EntityT);
+					if (e->m_staging)
+						s.unusedComponents += sizeof(std::tuple<TComponents...>);
+#else
+					// the tuple padding is not used either
+					s.entities += sizeof(EntityT) - sizeof(std::tuple<TComponents...>);
+					s.unusedComponents += sizeof(std::tuple<TComponents...>);
+					countTupleComponents<0>(*e, s);
+#endif
+					countVector(e->m_queryPositions, s.entities, s);
+					countVector(e->m_children, s.entities, s);
+					countVector(e->m_scripts, s.scripts, s);
+				}
+			}
+			for (auto& slot : m_slots)
+			{
+				s.slack += slot.scripts.capacity() * sizeof(slot.scripts[0]);
+				s.slack += slot.queryPositions.capacity() * sizeof(size_t);
+			}
+			countVector(m_entities, s.entities, s);
+			countVector(m_freshEntities, s.entities, s);
+			countVector(m_dead, s.entities, s);
+			countVector(m_dying, s.entities, s);
+			countVector(m_changing, s.entities, s);
+			countVector(m_positionScratch, s.entities, s);
+			countVector(m_hierarchyStack, s.entities, s);
+			for (auto& v : m_killed)
+				countVector(v, s.entities, s);
+			for (auto& v : m_migrations)
+				countVector(v, s.entities, s);
+			for (auto& v : m_levels)
+				countVector(v, s.entities, s);
+			for (auto& v : m_changeVersions)
+				countVector(v, s.entities, s);
+			countVector(m_deltaLog, s.entities, s);
+#ifdef ECS_ARCHETYPE_STORAGE
+			s.unusedComponents += m_stagingPool.size() * sizeof(std::tuple<TComponents...>);
+			for (auto& a : m_archetypes)
+			{
+				countVector(a->m_entities, s.entities, s);
+				countColumns<0>(*a, s);
+			}
+#endif
+			countSparseSets<0>(s);
+			for (auto& q : m_queries)
+			{
+				size_t bytes = 0;
+				countVector(q->entities, bytes, s);
+				countVector(q->refs, bytes, s);
+#ifdef ECS_ARCHETYPE_STORAGE
+				countVector(q->archetypes, bytes, s);
+#endif
+				s.queries.push_back(bytes);
+			}
+			countVector(m_scripted, s.scripts, s);
+			for (auto& g : m_scriptGroups)
+				countVector(g.calls, s.scripts, s);
+			return s;
+		}
+		/*
+		releases the unused capacity of all containers and the entity pages without entities (e.g. after a level was unloaded).
+		the next entities and queries will grow the containers again
+		*/
+		void shrinkToFit()
+		{
+			assert(!ThreadPool::insideParallelTask() && !m_parallelSystems);
+			for (size_t p = 0; p < m_pages.size(); p++)
+			{
+				if (!m_pages[p])
+					continue;
+				bool used = false;
+				for (size_t i = p * s_entitiesPerPage; i < std::min((p + 1) * s_entitiesPerPage, m_slots.size()) && !used; i++)
+					used = m_slots[i].entity != nullptr;
+				if (used)
+					continue;
+				// the slots keep their generation, so old handles stay invalid
+				m_allocator->deallocate(m_pages[p], sizeof(EntityT) * s_entitiesPerPage, alignof(EntityT));
+				m_pages[p] = nullptr;
+			}
+			for (auto& slot : m_slots)
+			{
+				if (slot.entity)
+				{
+					slot.entity->m_queryPositions.shrink_to_fit();
+					slot.entity->m_children.shrink_to_fit();
+					slot.entity->m_scripts.shrink_to_fit();
+				}
+				std::vector<shared_ptr<typename EntityT::ScriptT>>().swap(slot.scripts);
+				std::vector<size_t>().swap(slot.queryPositions);
+			}
+			m_freeSlots.shrink_to_fit();
+			m_entities.shrink_to_fit();
+			m_freshEntities.shrink_to_fit();
+			m_dead.shrink_to_fit();
+			m_dying.shrink_to_fit();
+			m_changing.shrink_to_fit();
+			m_positionScratch.shrink_to_fit();
+			m_hierarchyStack.shrink_to_fit();
+			for (auto& v : m_killed)
+				v.shrink_to_fit();
+			for (auto& v : m_migrations)
+				v.shrink_to_fit();
+			for (auto& v : m_levels)
+				v.shrink_to_fit();
+			for (auto& v : m_changeVersions)
+				v.shrink_to_fit();
+			m_deltaLog.shrink_to_fit();
+#ifdef ECS_ARCHETYPE_STORAGE
+			m_stagingPool.clear();
+			m_stagingPool.shrink_to_fit();
+			for (auto& a : m_archetypes)
+			{
+				a->m_entities.shrink_to_fit();
+				shrinkColumns<0>(*a);
+			}
+#endif
+			shrinkSparseSets<0>();
+			for (auto& q : m_queries)
+			{
+				q->entities.shrink_to_fit();
+				q->refs.shrink_to_fit();
+#ifdef ECS_ARCHETYPE_STORAGE
+				q->archetypes.shrink_to_fit();
+#endif
+			}
+			m_scripted.shrink_to_fit();
+			for (auto& g : m_scriptGroups)
+				g.calls.shrink_to_fit();
+		}
+		template<typename... TReq>
+		void addQuery()
+		{
+			assert(m_state == States::Init);
+			// add systems before adding entities
+			getQuery<TReq...>();
+		}
+		/*
+		copies the query at the end of every tick, other threads can read the copy with readQuery() while the manager changes.
+		only the handles, IDs and the components of TReq are copied
+		*/
+		template<typename... TReq>
+		void publishQuery()
+		{
+			static_assert(!HasSparseStorage<TReq...>::value, "sparse components are not part of queries");
+			static_assert(CopyableTypes<TReq...>::value, "the components of a published query must be copyable");
+			assert(m_state == States::Init);
+			const SystemKeyT key = getQuery<TReq...>().key;
+			if (!findPublished(key))
+			{
+				// only this query instantiates the copies of its components
+				m_published.push_back(Published{ std::unique_ptr<PublishedQuery<TComponents...>>(new PublishedQuery<TComponents...>(key)),
+					&Manager::copyFrame<TReq...> });
+			}
+		}
+		/*
+		the last published copy of a query (see publishQuery), may be called from any thread without locking.
+		frames that are still referenced by a view are not overwritten, keep views only until the data is extracted
+		*/
+		template<typename... TReq>
+		QueryViewT readQuery() const
+		{
+			auto q = findPublished(getComponentMask<TReq...>());
+			assert(q && "the query was not published with publishQuery()");
+			return QueryViewT(*q);
+		}
+		void addSystem(shared_ptr<SystemT> s)
+		{
+			assert(m_state == States::Init);
+			s->m_manager = this;
+			m_systems.push_back(s);
+		}
+		/*
+		the entity is owned by the manager and will be deleted in the tick after it was killed.
+		use getHandle() to keep a reference that can be verified later
+		*/
+		EntityT* addEntity()
+		{
+			assert(m_state == States::Running);
+			std::lock_guard<std::mutex> g(m_muEntityAdd);
+			return createEntity();
+		}
+		/*
+		adds count entities with the components TComps and calls init(EntityT& e, size_t i) for each of them.
+		the lock is only taken once, and entities with the same components are matched against the queries once in the next tick
+		*/
+		template<typename... TComps, typename TFunctor>
+		void addEntities(size_t count, TFunctor init)
+		{
+			assert(m_state == States::Running);
+			if (!count)
+				return;
+			std::vector<EntityT*> ents(count);
+			{
+				std::lock_guard<std::mutex> g(m_muEntityAdd);
+				reserveGrowth(m_freshEntities, m_freshEntities.size() + count);
+				for (size_t i = 0; i < count; i++)
+					ents[i] = createEntity();
+			}
+			// init is called without the lock, it might add more entities
+			const SystemKeyT& mask = getComponentMask<TComps...>();
+			for (size_t i = 0; i < count; i++)
+			{
+				ents[i]->setComponentFlags(mask);
+				init(*ents[i], i);
+			}
+		}
+		// returns nullptr if the entity was already removed
+		EntityT* getEntity(EntityHandle h) const noexcept
+		{
+			if (h.index >= m_slots.size() || m_slots[h.index].generation != h.generation)
+				return nullptr;
+			return m_slots[h.index].entity;
+		}
+		// O(1) check if the entity of the handle still exists (it might be killed already)
+		bool isValid(EntityHandle h) const noexcept
+		{
+			return getEntity(h) != nullptr;
+		}
+		/*
+		stores a single value of type T in the manager (e.g. the camera or the input), an existing resource of the same type is replaced.
+		resources are not part of the entities, systems declare their access with readsResources() and writesResources()
+		*/
+		template<class T, typename... TArgs>
+		T& addResource(TArgs&&... args)
+		{
+			static_assert(!ContainsType<T, TComponents...>::value, "components can not be resources");
+			assert(!ThreadPool::insideParallelTask() && !m_parallelSystems && "resources can only be added and removed by the thread that calls tick()");
+			const size_t index = getResourceIndex<T>();
+			if (index >= m_resources.size())
+				m_resources.resize(index + 1);
+			auto r = new Resource<T>(std::forward<TArgs>(args)...);
+			m_resources[index].reset(r);
+			return r->value;
+		}
+		template<class T>
+		void removeResource()
+		{
+			assert(!ThreadPool::insideParallelTask() && !m_parallelSystems && "resources can only be added and removed by the thread that calls tick()");
+			const size_t index = getResourceIndex<T>();
+			if (index < m_resources.size())
+				m_resources[index].reset();
+		}
+		template<class T>
+		bool hasResource() const noexcept
+		{
+			const size_t index = getResourceIndex<T>();
+			return index < m_resources.size() && m_resources[index];
+		}
+		// O(1) access to the resource of type T, it must have been added with addResource()
+		template<class T>
+		T& getResource() noexcept
+		{
+			assert(hasResource<T>() && "the resource was not added with addResource()");
+			return static_cast<Resource<T>*>(m_resources[getResourceIndex<T>()].get())->value;
+		}
+		template<class T>
+		const T& getResource() const noexcept
+		{
+			assert(hasResource<T>() && "the resource was not added with addResource()");
+			return static_cast<const Resource<T>*>(m_resources[getResourceIndex<T>()].get())->value;
+		}
+		/*
+		returns the command buffer of the calling thread.
+		must be called from the thread that calls tick() or from within forEachParallel
+		*/
+		CommandBufferT& getCommandBuffer()
+		{
+			assert(m_state == States::Running);
+			const size_t index = ThreadPool::getThreadIndex();
+			assert(index < m_commandBuffers.size());
+			return *m_commandBuffers[index];
+		}
+		/*
+		appends all spawned entities to out (the IDs and components, scripts are not saved).
+		the components are written as one column per component type, see Serializer for the format of a component
+		*/
+		void saveSnapshot(std::vector<char>& out) const
+		{
+			assert(m_state == States::Running);
+			SnapshotWriter w(out);
+			writeHeader(w, s_snapshotMagic);
+			writeEntities(w, out, m_entities);
+		}
+		/*
+		adds the entities of a snapshot to a manager without entities. the entities are spawned at once and keep their IDs,
+		onEntitySpawn() is not called. data is only read and may point to a memory mapped file.
+		returns false and leaves the manager unchanged if the data is not a snapshot of the same component types, an ID occurs twice
+		or a column does not have the size of its components. only if a custom Serializer without a fixed size reads a different number
+		of bytes than it has written, the entities are already spawned with incomplete components and false is returned as well
+		*/
+		bool loadSnapshot(const void* data, size_t size)
+		{
+			assert(m_state == States::Running);
+			assert(m_entities.empty() && m_freshEntities.empty() && "snapshots are loaded into an empty manager");
+			ECS_PROFILE_SCOPE("loadSnapshot", size);
+			SnapshotReader r(data, size);
+			EntityTable table;
+			if (!readHeader(r, s_snapshotMagic) || !readEntities(r, table) || r.remaining())
+				return false;
+			m_replicasValid = false;
+			return spawnEntities(table);
+		}
+		/*
+		records the spawned, killed and changed entities from now on, saveDelta() needs the history.
+		the history grows until it is discarded with trimDeltaHistory()
+		*/
+		void setDeltaHistory(bool enable)
+		{
+			m_deltaHistory = enable;
+			if (!enable)
+				m_deltaLog.clear();
+		}
+		// forgets the history up to the change version (e.g. the oldest version all clients have received)
+		void trimDeltaHistory(uint64_t version)
+		{
+			auto end = std::upper_bound(m_deltaLog.begin(), m_deltaLog.end(), version, [](uint64_t v, const DeltaRecord& d)
+			{
+				return v < d.version;
+			});
+			m_deltaLog.erase(m_deltaLog.begin(), end);
+		}
+		/*
+		appends the changes after the change version since (see advanceChangeVersion) to out:
+		the entities spawned since then with all their components, the IDs of killed entities,
+		the masks of entities that got or lost components and the changed values of all components with TrackChanges.
+		only the history and the change versions are read, unchanged entities are not visited
+		*/
+		void saveDelta(uint64_t since, std::vector<char>& out) const
+		{
+			assert(m_state == States::Running);
+			assert(m_deltaHistory && "the history is recorded after setDeltaHistory(true)");
+			SnapshotWriter w(out);
+			writeHeader(w, s_deltaMagic);
+
+			// 1 = spawned since then, 2 = components changed
+			std::vector<char> marks(m_slots.size(), 0);
+			std::vector<EntityT*> spawned, migrated;
+			std::vector<uint64_t> killed;
+			auto it = std::upper_bound(m_deltaLog.begin(), m_deltaLog.end(), since, [](uint64_t v, const DeltaRecord& d)
+			{
+				return v < d.version;
+			});
+			for (; it != m_deltaLog.end(); ++it)
+			{
+				if (it->event == DeltaEvent::Killed)
+				{
+					killed.push_back(it->id);
+					continue;
+				}
+				EntityT* e = getEntity(it->handle);
+				if (!e || marks[it->handle.index])
+					continue;
+				if (it->event == DeltaEvent::Spawned)
+				{
+					marks[it->handle.index] = 1;
+					spawned.push_back(e);
+				}
+				else
+				{
+					marks[it->handle.index] = 2;
+					migrated.push_back(e);
+				}
+			}
+			writeEntities(w, out, spawned);
+			w.write(uint64_t(killed.size()));
+			for (auto id : killed)
+				w.write(id);
+			w.write(uint64_t(migrated.size()));
+			for (auto e : migrated)
+				writeRecord(w, *e);
+			writeChanges<0>(w, out, since, marks);
+		}
+		/*
+		applies a delta of saveDelta() at once: spawns the new entities, removes the killed ones, adds and removes components and
+		copies the changed values. entities are identified by their ID, so the manager must start with a snapshot of the same world.
+		the entities are changed immediately (killed entities are removed like in tick()), onEntitySpawn() is not called for new entities.
+		returns false and leaves the manager unchanged if the data is not a delta of the same component types, a spawned entity already exists
+		or a column does not have the size of its components (see loadSnapshot() for custom serializers)
+		*/
+		bool applyDelta(const void* data, size_t size)
+		{
+			assert(m_state == States::Running);
+			assert(!ThreadPool::insideParallelTask());
+			ECS_PROFILE_SCOPE("applyDelta", size);
+			SnapshotReader r(data, size);
+			EntityTable table;
+			if (!readHeader(r, s_deltaMagic) || !readEntities(r, table))
+				return false;
+			uint64_t nKilled = 0;
+			r.read(nKilled);
+			if (r.failed() || nKilled > r.remaining() / sizeof(uint64_t))
+				return false;
+			const char* killed = r.skip(size_t(nKilled) * sizeof(uint64_t));
+			uint64_t nMigrated = 0;
+			r.read(nMigrated);
+			const size_t recordSize = sizeof(uint64_t) * (1 + SystemKeyT::s_words);
+			if (r.failed() || nMigrated > r.remaining() / recordSize || !knownMasks(r.skip(0), size_t(nMigrated)))
+				return false;
+			const char* migrated = r.skip(size_t(nMigrated) * recordSize);
+			std::array<DeltaColumn, sizeof...(TComponents)> changes;
+			if (!readChanges<0>(r, changes) || r.remaining())
+				return false;
+
+			if (!m_replicasValid)
+			{
+				m_replicas.clear();
+				for (auto e : m_entities)
+					m_replicas[e->m_id] = e->m_handle;
+				m_replicasValid = true;
+			}
+			// e.g. the same delta applied twice
+			for (size_t i = 0; i < table.count; i++)
+			{
+				uint64_t id;
+				std::memcpy(&id, table.records + i * recordSize, sizeof(id));
+				if (findReplica(id))
+					return false;
+			}
+			const size_t first = m_entities.size();
+			bool ok = spawnEntities(table);
+			for (size_t i = first; i < m_entities.size(); i++)
+				m_replicas[m_entities[i]->m_id] = m_entities[i]->m_handle;
+
+			for (size_t i = 0; i < size_t(nKilled); i++)
+			{
+				uint64_t id;
+				std::memcpy(&id, killed + i * sizeof(id), sizeof(id));
+				EntityT* e = findReplica(id);
+				if (e)
+				{
+					m_replicas.erase(size_t(id));
+					e->kill();
+				}
+			}
+			// same order as in tick()
+			removeKilledEntities();
+			applyMigrations();
+			for (auto e : m_dead)
+				releaseEntity(*e);
+			m_dead.resize(0);
+
+			for (size_t i = 0; i < size_t(nMigrated); i++)
+			{
+				uint64_t id;
+				std::memcpy(&id, migrated + i * recordSize, sizeof(id));
+				EntityT* e = findReplica(id);
+				if (e)
+					setComponents(*e, readMask(migrated + i * recordSize + sizeof(uint64_t)));
+			}
+			applyChanges<0>(changes);
+			for (auto& c : changes)
+				ok = ok && !c.values.failed() && !c.values.remaining();
+			return ok;
+		}
+		/*
+		queries that were not added with addQuery() will be cached on first use.
+		the returned reference stays valid for the lifetime of the manager
+		*/
+		template<typename... TReq>
+		const std::vector<EntityT*>& getEntsWith()
+		{
+			static_assert(!HasSparseStorage<TReq...>::value, "sparse components are not part of queries, use forEach");
+			assert(m_state == States::Running);
+			return getQuery<TReq...>().entities;
+		}
+#ifdef ECS_ARCHETYPE_STORAGE
+		/*
+		returns all archetypes that contain the requested components.
+		iterating over the columns of these archetypes only touches the memory of the requested components
+		*/
+		template<typename... TReq>
+		const std::vector<ArchetypeT*>& getArchetypesWith()
+		{
+			static_assert(!HasSparseStorage<TReq...>::value, "sparse components are not part of archetypes");
+			assert(m_state == States::Running);
+			return getQuery<TReq...>().archetypes;
+		}
+#endif
+		void tick(float dt)
+		{
+			assert(m_state == States::Running);
+			ECS_PROFILE_SCOPE("tick", m_entities.size());
+			// commands that were recorded since the last tick
+			applyCommands();
+
+			// remove dead entities + add entities with missing components
+
+			// remove dead entities:
+			removeKilledEntities();
+			// component changes of living entities
+			applyMigrations();
+			// the entities are not referenced anymore
+			for (auto e : m_dead)
+				releaseEntity(*e);
+			m_dead.resize(0);
+
+			// add new components
+			if (m_freshEntities.size())
+			{
+				ECS_PROFILE_SCOPE("spawnEntities", m_freshEntities.size());
+				reserveGrowth(m_entities, m_entities.size() + m_freshEntities.size());
+				// the versions are only resized here, parallel loops may mark changes of spawned entities
+				for (auto& v : m_changeVersions)
+					v.resize(m_slots.size(), 0);
+				// consecutive entities usually have the same components (e.g. from addEntities)
+				MaskInfo* info = nullptr;
+				SystemKeyT infoKey;
+				for (auto& e : m_freshEntities)
+				{
+					assert(e->m_componentsAdded == false);
+					if (e->isAlive())
+					{
+						// run startup script
+						e->runStartupScript();
+						// pass through systems
+						for (auto& s : m_systems)
+							s->onEntitySpawn(*e);
+
+						e->m_componentsAdded = true;
+						recordDelta(DeltaEvent::Spawned, *e);
+						// all components of a new entity count as changed
+						for (auto& v : m_changeVersions)
+							v[e->m_handle.index] = m_changeVersion.load(std::memory_order_relaxed);
+						if (!e->m_sparseFlags.none())
+							insertSparseComponents<0>(*e);
+						e->m_entityIndex = m_entities.size();
+						m_entities.push_back(e);
+						// generate component key
+						auto entKey = getComponentKeyFromEntity(*e);
+						if (!info || infoKey != entKey)
+						{
+							info = &getMaskInfo(entKey);
+							infoKey = entKey;
+						}
+#ifdef ECS_ARCHETYPE_STORAGE
+						info->archetype->insert(*e);
+						recycleStaging(e->m_staging);
+#endif
+						// only the queries that match the key
+						for (size_t i = 0; i < info->queries.size(); i++)
+							addToQuery(*info->queries[i], *e, i);
+						if (e->hasScript())
+						{
+							e->m_scriptedIndex = m_scripted.size();
+							m_scripted.push_back(e);
+							m_scriptGroupsDirty = true;
+						}
+						// killed by a system or the startup script
+						if (!e->isAlive())
+							registerKill(*e);
+					}
+					else
+					{
+						// killed before it was spawned
+						releaseEntity(*e);
+					}
+				}
+				m_freshEntities.resize(0);
+			}
+
+			// run systems
+			for (auto& stage : m_systemStages)
+			{
+				if (stage.size() == 1)
+				{
+					ECS_PROFILE_SCOPE(typeid(*stage[0]).name(), 1);
+					stage[0]->tick(dt);
+					continue;
+				}
+				// the systems of a stage do not conflict
+				m_parallelSystems = true;
+				beginCommandBatch();
+				auto task = [this, &stage, dt](size_t i)
+				{
+					ECS_PROFILE_SCOPE(typeid(*stage[i]).name(), 1);
+					getCommandBuffer().m_key = i;
+					stage[i]->tick(dt);
+				};
+				m_pool->run(stage.size(), task);
+				beginCommandBatch();
+				m_parallelSystems = false;
+			}
+
+			// run scripts for entities
+			{
+				ECS_PROFILE_SCOPE("scripts", m_scripted.size());
+				if (m_scriptBatching)
+					runScriptGroups(dt);
+				else
+				{
+					for (auto& e : m_scripted)
+						if (e->hasScript())
+							e->runScript(dt);
+				}
+			}
+			m_tickCount++;
+			if (m_published.size())
+				publishQueries();
+		}
+		/*
+		calls func(EntityT&) for every entity that has all components of TReq.
+		with sparse components the smaller side (the query of the other components or a sparse set) is iterated
+		*/
+		template<typename... TReq, typename TFunctor>
+		void forEach(TFunctor func)
+		{
+			assert(m_state == States::Running);
+			forEachImpl<TReq...>(func, HasSparseStorage<TReq...>());
+		}
+		template<typename... TReq, typename TFunctor>
+		void forEachParallel(TFunctor func)
+		{
+			static_assert(!HasSparseStorage<TReq...>::value, "sparse components can not be iterated in parallel");
+			assert(m_state == States::Running);
+			auto& vec = getEntsWith<TReq...>();
+			auto body = [&vec, &func](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i != end; ++i)
+					func(*vec[i]);
+			};
+			// the query keeps a running estimate of the time per entity
+			parallelFor("forEachParallel", vec.size(), getCostHistory<std::tuple<std::tuple<TReq...>, TFunctor>>(), body);
+		}
+		/*
+		calls func(Ts&...) for every entity that has all components of Ts.
+		the component references are passed directly, a component may be declared const (each<const T>) for read only access
+		*/
+		template<typename... Ts, typename TFunctor>
+		void each(TFunctor func)
+		{
+			assert(m_state == States::Running);
+			eachImpl<Ts...>(func, HasSparseStorage<Ts...>());
+		}
+		/*
+		calls func(size_t id, Ts&...) for every entity that has all components of Ts.
+		id is the unique ID of the entity
+		*/
+		template<typename... Ts, typename TFunctor>
+		void eachWithID(TFunctor func)
+		{
+			assert(m_state == States::Running);
+			eachWithIDImpl<Ts...>(func, HasSparseStorage<Ts...>());
+		}
+		/*
+		calls func(EntityT&) for every entity whose component T was added or accessed mutably after the version since.
+		T must track changes (see TrackChanges). use the const getComponent() within func, otherwise the entity is marked again
+		*/
+		template<class T, typename TFunctor>
+		void forEachChanged(uint64_t since, TFunctor func)
+		{
+			static_assert(TrackChanges<T>::value, "the component does not track changes");
+			assert(m_state == States::Running);
+			// only the slots with a newer version are resolved to entities
+			const auto& versions = m_changeVersions[TrackedIndex<getComponentIndex<T>(), TComponents...>::value];
+			for (size_t i = 0; i < versions.size(); i++)
+			{
+				if (versions[i] <= since)
+					continue;
+				EntityT* e = m_slots[i].entity;
+				if (e && e->m_componentsAdded && e->template hasComponent<T>())
+					func(*e);
+			}
+		}
+		/*
+		returns the version of all changes so far, later changes get a higher version.
+		a system keeps the returned value and passes it to forEachChanged in its next tick
+		*/
+		uint64_t advanceChangeVersion() noexcept
+		{
+			return m_changeVersion.fetch_add(1);
+		}
+		/*
+		components with sparse storage of type T (see SparseStorage).
+		iterating over the set only touches the dense array of the components
+		*/
+		template<class T>
+		SparseSet<T, EntityT>& getSparseSet()
+		{
+			static_assert(SparseStorage<T>::value, "the component does not use sparse storage");
+			return sparseSet<T>();
+		}
+		/*
+		calls func(size_t count, Ts*... components) for contiguous ranges of entities that have all components of Ts.
+		with ECS_ARCHETYPE_STORAGE each call covers one archetype and the arrays start at ECS_COLUMN_ALIGNMENT,
+		otherwise the components are not contiguous and func is called for every entity with count = 1
+		*/
+		template<typename... Ts, typename TFunctor>
+		void forEachChunk(TFunctor func)
+		{
+			static_assert(!HasSparseStorage<Ts...>::value, "sparse components are not part of archetypes");
+			assert(m_state == States::Running);
+#ifdef ECS_ARCHETYPE_STORAGE
+			for (auto a : getArchetypesWith<typename std::remove_const<Ts>::type...>())
+			{
+				if (a->size())
+				{
+					func(a->size(), static_cast<Ts*>(a->template column<typename std::remove_const<Ts>::type>().data())...);
+					markChanged<Ts...>(*a, 0, a->size());
+				}
+			}
+#else
+			for (auto& e : getEntsWith<typename std::remove_const<Ts>::type...>())
+			{
+				markChanged<Ts...>(*e);
+				func(size_t(1), static_cast<Ts*>(&e->template getComponentUnchecked<typename std::remove_const<Ts>::type>())...);
+			}
+#endif
+		}
+		/*
+		like forEachChunk, but the archetypes are split into chunks of s_chunkSize entities that are distributed between threads.
+		the arrays of every chunk keep the alignment of the archetype arrays
+		*/
+		template<typename... Ts, typename TFunctor>
+		void forEachChunkParallel(TFunctor func)
+		{
+			static_assert(!HasSparseStorage<Ts...>::value, "sparse components are not part of archetypes");
+			assert(m_state == States::Running);
+#ifdef ECS_ARCHETYPE_STORAGE
+			auto& archetypes = getArchetypesWith<typename std::remove_const<Ts>::type...>();
+			// first chunk index of every archetype
+			std::vector<size_t> starts;
+			starts.reserve(archetypes.size());
+			size_t nChunks = 0;
+			for (auto a : archetypes)
+			{
+				starts.push_back(nChunks);
+				nChunks += (a->size() + s_chunkSize - 1) / s_chunkSize;
+			}
+			auto body = [&archetypes, &starts, &func](size_t begin, size_t end)
+			{
+				// archetype of the first chunk
+				size_t i = std::upper_bound(starts.begin(), starts.end(), begin) - starts.begin() - 1;
+				for (size_t c = begin; c != end; ++c)
+				{
+					while (c >= starts[i] + (archetypes[i]->size() + s_chunkSize - 1) / s_chunkSize)
+						i++;
+					ArchetypeT& a = *archetypes[i];
+					const size_t row = (c - starts[i]) * s_chunkSize;
+					const size_t count = std::min(size_t(s_chunkSize), a.size() - row);
+					func(count, static_cast<Ts*>(a.template column<typename std::remove_const<Ts>::type>().data() + row)...);
+					markChanged<Ts...>(a, row, row + count);
+				}
+			};
+			parallelFor("forEachChunkParallel", nChunks, getCostHistory<std::tuple<std::tuple<Ts...>, TFunctor, ArchetypeT>>(), body);
+#else
+			auto& vec = getEntsWith<typename std::remove_const<Ts>::type...>();
+			auto body = [&vec, &func](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i != end; ++i)
+				{
+					markChanged<Ts...>(*vec[i]);
+					func(size_t(1), static_cast<Ts*>(&vec[i]->template getComponentUnchecked<typename std::remove_const<Ts>::type>())...);
+				}
+			};
+			parallelFor("forEachChunkParallel", vec.size(), getCostHistory<std::tuple<std::tuple<Ts...>, TFunctor, EntityT>>(), body);
+#endif
+		}
+		/*
+		calls func(EntityT& e, EntityT* parent) for every entity that has all components of TReq, parents before their children.
+		the entities without parent are visited first (parent is nullptr), then the levels of the hierarchy one after another.
+		every level is a linear array that is distributed between threads like in forEachParallel
+		*/
+		template<typename... TReq, typename TFunctor>
+		void forEachHierarchical(TFunctor func)
+		{
+			static_assert(!HasSparseStorage<TReq...>::value, "sparse components can not be iterated in parallel");
+			assert(m_state == States::Running);
+			auto& vec = getEntsWith<TReq...>();
+			auto roots = [&vec, &func](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i != end; ++i)
+				{
+					if (!vec[i]->m_parent)
+						func(*vec[i], static_cast<EntityT*>(nullptr));
+				}
+			};
+			parallelFor("forEachHierarchical", vec.size(), getCostHistory<std::tuple<std::tuple<TReq...>, TFunctor, EntityT>>(), roots);
+			const SystemKeyT& mask = getComponentMask<TReq...>();
+			for (auto& level : m_levels)
+			{
+				auto body = [&level, &mask, &func](size_t begin, size_t end)
+				{
+					for (size_t i = begin; i != end; ++i)
+					{
+						EntityT& e = *level[i];
+						// the levels contain entities that are not spawned yet
+						if (e.m_componentsAdded && e.m_componentFlags.contains(mask))
+							func(e, e.m_parent);
+					}
+				};
+				// all levels share one history
+				parallelFor("forEachHierarchical", level.size(), getCostHistory<std::tuple<std::tuple<TReq...>, TFunctor, EntityT*>>(), body);
+			}
+		}
+#ifdef ECS_PROFILER
+		// recorded events of all ticks (only with ECS_PROFILER)
+		Profiler& getProfiler() noexcept
+		{
+			return m_profiler;
+		}
+		const Profiler& getProfiler() const noexcept
+		{
+			return m_profiler;
+		}
+#endif
+		/*
+		sets how forEachParallel distributes entities between threads.
+		grainSize is the number of entities a thread takes at once with ParallelSchedule::WorkStealing
+		*/
+		void setParallelSchedule(ParallelSchedule schedule, size_t grainSize = 64)
+		{
+			assert(grainSize > 0);
+			m_schedule = schedule;
+			m_grainSize = grainSize;
+		}
+		// number of threads that execute parallel loops, including the thread that calls tick()
+		size_t getThreadCount() const noexcept
+		{
+			return m_nThreads;
+		}
+		const shared_ptr<ThreadPool>& getThreadPool() const noexcept
+		{
+			return m_pool;
+		}
+		/*
+		pins the threads to cores and groups them into NUMA domains. placement[0] is the calling thread (it should call tick())
+		and placement[i] the i-th worker, the size must be getThreadCount().
+		afterwards every thread processes the same range of a parallel loop in each frame, and with the work stealing schedule
+		threads take work from threads of their own domain first. returns false if a thread could not be pinned
+		*/
+		bool setThreadPlacement(const std::vector<ThreadPlacement>& placement)
+		{
+			assert(placement.size() == m_nThreads);
+			return m_pool->setPlacement(placement);
+		}
+		/*
+		if enabled, scripts are executed grouped by their type instead of entity by entity.
+		groups of thread safe scripts (Script::isThreadSafe) are distributed like forEachParallel
+		*/
+		void setScriptBatching(bool enable)
+		{
+			m_scriptBatching = enable;
+		}
+		void start()
+		{
+			assert(m_state == States::Init);
+			// add queries
+			for (auto& s : m_systems)
+				s->initQueries(*this);
+			buildSystemStages();
+
+			m_state = States::Running;
+
+			// init systems
+			for (auto& s : m_systems)
+				s->begin();
+		}
+	private:
+		template<class T>
+		static constexpr size_t getComponentIndex()
+		{
+			return ComponentIndex<T, TComponents...>::value;
+		}
+		// masks of TReq, evaluated at compile time
+		template<typename... TReq>
+		struct ComponentKey
+		{
+			static_assert(UniqueTypes<TReq...>::value, "component types must be unique");
+			static constexpr SystemKeyT value = SystemKeyT::fromIndices(ComponentIndex<TReq, TComponents...>::value...);
+			// the components with and without sparse storage (the index -1 sets no bit)
+			static constexpr SystemKeyT sparse = SystemKeyT::fromIndices(
+				(SparseStorage<TReq>::value ? ComponentIndex<TReq, TComponents...>::value : size_t(-1))...);
+			static constexpr SystemKeyT dense = SystemKeyT::fromIndices(
+				(SparseStorage<TReq>::value ? size_t(-1) : ComponentIndex<TReq, TComponents...>::value)...);
+		};
+		template<typename... TReq>
+		static const SystemKeyT& getComponentMask() noexcept
+		{
+			return ComponentKey<TReq...>::value;
+		}
+		static SystemKeyT getComponentKeyFromEntity(const EntityT& e)
+		{
+			return e.m_componentFlags;
+		}
+		// the sets of components without sparse storage are always empty
+		template<class T>
+		SparseSet<T, EntityT>& sparseSet()
+		{
+#ifndef _MSC_BUILD
+			return std::get<getComponentIndex<T>()>(m_sparseSets);
+#else
+			return EntityT::template _getComponent<SparseSet<T, EntityT>>(m_sparseSets);
+#endif
+		}
+		static const SystemKeyT& getSparseMask() noexcept
+		{
+			return ComponentKey<TComponents...>::sparse;
+		}
+		static const SystemKeyT& getDenseMask() noexcept
+		{
+			return ComponentKey<TComponents...>::dense;
+		}
+		template<typename... TReq, typename TFunctor>
+		void forEachImpl(TFunctor& func, std::false_type)
+		{
+			for (auto& e : getEntsWith<TReq...>())
+				func(*e);
+		}
+		template<typename... TReq, typename TFunctor>
+		void forEachImpl(TFunctor& func, std::true_type)
+		{
+			forEachSparse<TReq...>(func);
+		}
+		template<typename... Ts, typename TFunctor>
+		void eachImpl(TFunctor& func, std::false_type)
+		{
+#ifdef ECS_ARCHETYPE_STORAGE
+			// resolve the component arrays once per archetype
+			for (auto a : getArchetypesWith<typename std::remove_const<Ts>::type...>())
+			{
+				eachRow(a->size(), func, a->template column<typename std::remove_const<Ts>::type>().data()...);
+				markChanged<Ts...>(*a, 0, a->size());
+			}
+#else
+			for (auto& e : getEntsWith<typename std::remove_const<Ts>::type...>())
+			{
+				markChanged<Ts...>(*e);
+				func(e->template getComponentUnchecked<typename std::remove_const<Ts>::type>()...);
+			}
+#endif
+		}
+		template<typename... Ts, typename TFunctor>
+		void eachImpl(TFunctor& func, std::true_type)
+		{
+			auto row = [&func](EntityT& e)
+			{
+				markChanged<Ts...>(e);
+				func(e.template getComponentUnchecked<typename std::remove_const<Ts>::type>()...);
+			};
+			forEachSparse<typename std::remove_const<Ts>::type...>(row);
+		}
+		template<typename... Ts, typename TFunctor>
+		void eachWithIDImpl(TFunctor& func, std::false_type)
+		{
+#ifdef ECS_ARCHETYPE_STORAGE
+			for (auto a : getArchetypesWith<typename std::remove_const<Ts>::type...>())
+			{
+				eachRowWithID(*a, func, a->template column<typename std::remove_const<Ts>::type>().data()...);
+				markChanged<Ts...>(*a, 0, a->size());
+			}
+#else
+			for (auto& e : getEntsWith<typename std::remove_const<Ts>::type...>())
+			{
+				markChanged<Ts...>(*e);
+				func(e->getID(), e->template getComponentUnchecked<typename std::remove_const<Ts>::type>()...);
+			}
+#endif
+		}
+		template<typename... Ts, typename TFunctor>
+		void eachWithIDImpl(TFunctor& func, std::true_type)
+		{
+			auto row = [&func](EntityT& e)
+			{
+				markChanged<Ts...>(e);
+				func(e.getID(), e.template getComponentUnchecked<typename std::remove_const<Ts>::type>()...);
+			};
+			forEachSparse<typename std::remove_const<Ts>::type...>(row);
+		}
+		/*
+		iterates the smallest sparse set of TReq, or the query of the other components if it is smaller.
+		sparse sets are iterated from back to front, so func may remove the sparse component of the current entity
+		*/
+		template<typename... TReq, typename TFunctor>
+		void forEachSparse(TFunctor& func)
+		{
+			const SystemKeyT& sparse = ComponentKey<TReq...>::sparse;
+			const SystemKeyT& dense = ComponentKey<TReq...>::dense;
+			const std::vector<EntityT*>* smallest = nullptr;
+			for (size_t i = 0; i < sizeof...(TComponents); i++)
+			{
+				if (!sparse.test(i))
+					continue;
+				const auto& ents = getSparseEntities<0>(i);
+				if (!smallest || ents.size() < smallest->size())
+					smallest = &ents;
+			}
+			if (!dense.none())
+			{
+				const auto& ents = getQuery<TReq...>().entities;
+				if (ents.size() < smallest->size())
+				{
+					for (auto e : ents)
+					{
+						if (e->m_sparseFlags.contains(sparse))
+							func(*e);
+					}
+					return;
+				}
+			}
+			const auto& ents = *smallest;
+			for (size_t i = ents.size(); i-- > 0;)
+			{
+				// func removed more than one entity from the set
+				if (i >= ents.size())
+					continue;
+				EntityT& e = *ents[i];
+				if (e.m_componentFlags.contains(dense) && e.m_sparseFlags.contains(sparse))
+					func(e);
+			}
+		}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents)), const std::vector<EntityT*>&>::type getSparseEntities(size_t component)
+		{
+			if (component != I)
+				return getSparseEntities<I + 1>(component);
+			return std::get<I>(m_sparseSets).entities();
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents)), const std::vector<EntityT*>&>::type getSparseEntities(size_t)
+		{
+			assert(false);
+			return m_entities;
+		}
+		// moves the staged sparse components of a spawned entity into their sets
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type insertSparseComponents(EntityT& e)
+		{
+			if (e.m_sparseFlags.test(I))
+				std::get<I>(m_sparseSets).insert(e.m_handle.index, &e, std::move(std::get<I>(e.components())));
+			insertSparseComponents<I + 1>(e);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type insertSparseComponents(EntityT&)
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type eraseSparseComponents(EntityT& e)
+		{
+			if (e.m_sparseFlags.test(I))
+				std::get<I>(m_sparseSets).erase(e.m_handle.index);
+			eraseSparseComponents<I + 1>(e);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type eraseSparseComponents(EntityT&)
+		{}
+#ifdef ECS_ARCHETYPE_STORAGE
+		template<typename TFunctor, typename... Ts>
+		static void eachRow(size_t count, TFunctor& func, Ts*... columns)
+		{
+			for (size_t i = 0; i < count; i++)
+				func(columns[i]...);
+		}
+		template<typename TFunctor, typename... Ts>
+		static void eachRowWithID(const ArchetypeT& a, TFunctor& func, Ts*... columns)
+		{
+			const size_t count = a.size();
+			for (size_t i = 0; i < count; i++)
+				func(a.getEntity(i).getID(), columns[i]...);
+		}
+#endif
+		// format version, component types and their sizes
+		void writeHeader(SnapshotWriter& w, uint32_t magic) const
+		{
+			w.write(magic);
+			w.write(uint32_t(s_snapshotVersion));
+			w.write(uint32_t(sizeof...(TComponents)));
+			w.write(uint32_t(SystemKeyT::s_words));
+			writeComponentSizes<0>(w);
+		}
+		bool readHeader(SnapshotReader& r, uint32_t expected)
+		{
+			uint32_t magic = 0, version = 0, nComponents = 0, nWords = 0;
+			r.read(magic);
+			r.read(version);
+			r.read(nComponents);
+			r.read(nWords);
+			if (magic != expected || version != s_snapshotVersion || nComponents != sizeof...(TComponents) || nWords != SystemKeyT::s_words)
+				return false;
+			return readComponentSizes<0>(r);
+		}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type writeComponentSizes(SnapshotWriter& w) const
+		{
+			w.write(uint32_t(sizeof(typename std::tuple_element<I, std::tuple<TComponents...>>::type)));
+			writeComponentSizes<I + 1>(w);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type writeComponentSizes(SnapshotWriter&) const
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents)), bool>::type readComponentSizes(SnapshotReader& r)
+		{
+			uint32_t size = 0;
+			r.read(size);
+			if (size != sizeof(typename std::tuple_element<I, std::tuple<TComponents...>>::type))
+				return false;
+			return readComponentSizes<I + 1>(r);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents)), bool>::type readComponentSizes(SnapshotReader& r)
+		{
+			return !r.failed();
+		}
+		// ID and all components of an entity
+		static void writeRecord(SnapshotWriter& w, const EntityT& e)
+		{
+			w.write(uint64_t(e.m_id));
+			const SystemKeyT mask = e.m_componentFlags | e.m_sparseFlags;
+			for (size_t i = 0; i < SystemKeyT::s_words; i++)
+				w.write(mask.word(i));
+		}
+		static SystemKeyT readMask(const char* data)
+		{
+			SystemKeyT mask;
+			for (size_t i = 0; i < SystemKeyT::s_words; i++)
+			{
+				uint64_t word;
+				std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+				mask.setWord(i, word);
+			}
+			return mask;
+		}
+		// false if a record has a component that is not part of the manager
+		bool knownMasks(const char* records, size_t count) const
+		{
+			const size_t recordSize = sizeof(uint64_t) * (1 + SystemKeyT::s_words);
+			const SystemKeyT known = getDenseMask() | getSparseMask();
+			for (size_t i = 0; i < count; i++)
+			{
+				const SystemKeyT mask = readMask(records + i * recordSize + sizeof(uint64_t));
+				if ((mask & known) != mask)
+					return false;
+			}
+			return true;
+		}
+		// the records of the entities followed by one column per component type
+		void writeEntities(SnapshotWriter& w, std::vector<char>& out, const std::vector<EntityT*>& ents) const
+		{
+			w.write(uint64_t(ents.size()));
+			w.write(uint64_t(m_curID));
+			for (auto e : ents)
+				writeRecord(w, *e);
+			// byte size of every column, written after the column
+			const size_t lengths = w.size();
+			for (size_t i = 0; i < sizeof...(TComponents); i++)
+				w.write(uint64_t(0));
+			writeColumns<0>(w, out, lengths, ents);
+		}
+		// the columns of components with a fixed serialized size must match the number of entities with the component
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents)), bool>::type columnSizes(const std::array<uint64_t, sizeof...(TComponents)>& lengths,
+			const std::array<size_t, sizeof...(TComponents)>& counts) const
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			if (SerializedSize<T>::value && lengths[I] != uint64_t(counts[I]) * SerializedSize<T>::value)
+				return false;
+			return columnSizes<I + 1>(lengths, counts);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents)), bool>::type columnSizes(const std::array<uint64_t, sizeof...(TComponents)>&,
+			const std::array<size_t, sizeof...(TComponents)>&) const
+		{
+			return true;
+		}
+		// checks the entities of writeEntities() without changing the manager
+		bool readEntities(SnapshotReader& r, EntityTable& table)
+		{
+			uint64_t count = 0;
+			r.read(count);
+			r.read(table.nextID);
+			const size_t recordSize = sizeof(uint64_t) * (1 + SystemKeyT::s_words);
+			if (r.failed() || count > r.remaining() / recordSize)
+				return false;
+			table.count = size_t(count);
+			table.records = r.skip(table.count * recordSize);
+			std::array<uint64_t, sizeof...(TComponents)> lengths;
+			for (auto& l : lengths)
+				r.read(l);
+			if (r.failed() || !knownMasks(table.records, table.count))
+				return false;
+			// a column holds one value for every entity with the component
+			std::array<size_t, sizeof...(TComponents)> counts;
+			counts.fill(0);
+			std::vector<uint64_t> ids(table.count);
+			for (size_t i = 0; i < table.count; i++)
+			{
+				std::memcpy(&ids[i], table.records + i * recordSize, sizeof(uint64_t));
+				const SystemKeyT mask = readMask(table.records + i * recordSize + sizeof(uint64_t));
+				for (size_t j = 0; j < sizeof...(TComponents); j++)
+					counts[j] += mask.test(j) ? 1 : 0;
+			}
+			std::sort(ids.begin(), ids.end());
+			if (std::adjacent_find(ids.begin(), ids.end()) != ids.end() || !columnSizes<0>(lengths, counts))
+				return false;
+			table.columns.reserve(sizeof...(TComponents));
+			for (auto l : lengths)
+			{
+				// every column must be within the remaining bytes (a corrupt length must not wrap around)
+				if (l > r.remaining())
+					return false;
+				const char* column = r.skip(size_t(l));
+				if (r.failed())
+					return false;
+				table.columns.push_back(SnapshotReader(column, size_t(l)));
+			}
+			return true;
+		}
+		/*
+		allocates and spawns all entities of the table in a single pass over their memory,
+		consecutive entities with the same components share the lookup of their queries.
+		the entities are appended to m_entities, false if a column was not read completely
+		*/
+		bool spawnEntities(EntityTable& table)
+		{
+			const size_t recordSize = sizeof(uint64_t) * (1 + SystemKeyT::s_words);
+			std::lock_guard<std::mutex> g(m_muEntityAdd);
+			reserveGrowth(m_slots, m_slots.size() + table.count);
+			reserveGrowth(m_entities, m_entities.size() + table.count);
+			for (auto& v : m_changeVersions)
+				v.resize(m_slots.size() + table.count, 0);
+			const uint64_t changeVersion = m_changeVersion.load(std::memory_order_relaxed);
+			MaskInfo* info = nullptr;
+			SystemKeyT infoKey;
+			for (size_t i = 0; i < table.count; i++)
+			{
+				EntityT* e = allocateEntity();
+				e->m_manager = this;
+				uint64_t id;
+				std::memcpy(&id, table.records + i * recordSize, sizeof(id));
+				e->m_id = size_t(id);
+				e->setComponentFlags(readMask(table.records + i * recordSize + sizeof(uint64_t)));
+				e->m_componentsAdded = true;
+				recordDelta(DeltaEvent::Spawned, *e);
+				e->m_entityIndex = m_entities.size();
+				m_entities.push_back(e);
+				if (!info || infoKey != e->m_componentFlags)
+				{
+					info = &getMaskInfo(e->m_componentFlags);
+					infoKey = e->m_componentFlags;
+				}
+#ifdef ECS_ARCHETYPE_STORAGE
+				info->archetype->insertEmpty(*e);
+#endif
+				for (size_t j = 0; j < info->queries.size(); j++)
+					addToQuery(*info->queries[j], *e, j);
+				for (auto& v : m_changeVersions)
+					v[e->m_handle.index] = changeVersion;
+				readComponents<0>(*e, table.columns);
+			}
+			// free slots may have been reused
+			for (auto& v : m_changeVersions)
+				v.resize(m_slots.size());
+			m_curID = std::max(m_curID, size_t(table.nextID));
+			for (auto& c : table.columns)
+			{
+				if (c.failed() || c.remaining())
+					return false;
+			}
+			return true;
+		}
+		// the components of type I of all entities that have it
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type writeColumns(SnapshotWriter& w, std::vector<char>& out, size_t lengths,
+			const std::vector<EntityT*>& ents) const
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			const size_t start = w.size();
+			for (auto e : ents)
+			{
+				if (e->template hasComponent<T>())
+					Serializer<T>::write(w, e->template getComponentUnchecked<T>());
+			}
+			const uint64_t length = uint64_t(w.size() - start);
+			std::memcpy(out.data() + lengths + I * sizeof(uint64_t), &length, sizeof(length));
+			writeColumns<I + 1>(w, out, lengths, ents);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type writeColumns(SnapshotWriter&, std::vector<char>&, size_t,
+			const std::vector<EntityT*>&) const
+		{}
+		// reads the components of a loaded entity from their columns into the archetype arrays (or the sparse sets)
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type readComponents(EntityT& e, std::vector<SnapshotReader>& columns)
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			if (SparseStorage<T>::value)
+			{
+				if (e.m_sparseFlags.test(I))
+				{
+					T value;
+					Serializer<T>::read(columns[I], value);
+					std::get<I>(m_sparseSets).insert(e.m_handle.index, &e, std::move(value));
+				}
+			}
+			else if (e.m_componentFlags.test(I))
+			{
+#ifdef ECS_ARCHETYPE_STORAGE
+				// the row was added by insertEmpty()
+				auto& c = std::get<I>(e.m_archetype->m_columns);
+				c.emplace_back();
+				Serializer<T>::read(columns[I], c.back());
+#else
+				Serializer<T>::read(columns[I], std::get<I>(e.components()));
+#endif
+			}
+			readComponents<I + 1>(e, columns);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type readComponents(EntityT&, std::vector<SnapshotReader>&)
+		{}
+		PublishedQuery<TComponents...>* findPublished(const SystemKeyT& key) const
+		{
+			for (auto& p : m_published)
+			{
+				if (p.query->getKey() == key)
+					return p.query.get();
+			}
+			return nullptr;
+		}
+		// copies every published query into a frame that is not read and publishes it
+		void publishQueries()
+		{
+			ECS_PROFILE_SCOPE("publishQueries", m_published.size());
+			for (auto& p : m_published)
+			{
+				auto frame = p.query->beginPublish();
+				if (!frame)
+					continue;
+				frame->m_tick = m_tickCount;
+				(this->*p.copy)(*frame, getQuery(frame->m_key));
+				p.query->endPublish();
+			}
+		}
+		// copies the handles, IDs and the components TReq of the query into the frame
+		template<typename... TReq>
+		void copyFrame(QueryFrame<TComponents...>& frame, const Query& q)
+		{
+			frame.m_handles.resize(0);
+			frame.m_ids.resize(0);
+#ifdef ECS_ARCHETYPE_STORAGE
+			for (auto a : q.archetypes)
+			{
+				for (size_t i = 0; i < a->size(); i++)
+				{
+					frame.m_handles.push_back(a->getEntity(i).m_handle);
+					frame.m_ids.push_back(a->getEntity(i).m_id);
+				}
+			}
+			// whole arrays of the archetypes
+			int expand[] = { 0, (copyColumn<TReq>(frame, q), 0)... };
+			(void)expand;
+#else
+			int resize[] = { 0, (std::get<getComponentIndex<TReq>()>(frame.m_columns).resize(q.entities.size()), 0)... };
+			(void)resize;
+			// a single pass over the entities
+			for (size_t i = 0; i < q.entities.size(); i++)
+			{
+				const EntityT& e = *q.entities[i];
+				frame.m_handles.push_back(e.m_handle);
+				frame.m_ids.push_back(e.m_id);
+				int expand[] = { 0, (std::get<getComponentIndex<TReq>()>(frame.m_columns)[i] = std::get<getComponentIndex<TReq>()>(e.m_components), 0)... };
+				(void)expand;
+			}
+#endif
+		}
+#ifdef ECS_ARCHETYPE_STORAGE
+		template<class T>
+		static void copyColumn(QueryFrame<TComponents...>& frame, const Query& q)
+		{
+			auto& column = std::get<getComponentIndex<T>()>(frame.m_columns);
+			column.resize(0);
+			for (auto a : q.archetypes)
+			{
+				const auto& c = a->template column<T>();
+				column.insert(column.end(), c.begin(), c.end());
+			}
+		}
+#endif
+		void recordDelta(DeltaEvent event, const EntityT& e)
+		{
+			if (m_deltaHistory)
+				m_deltaLog.push_back(DeltaRecord{ m_changeVersion.load(std::memory_order_relaxed), uint64_t(e.m_id), e.m_handle, event });
+		}
+		// spawned entity with the ID (only entities of snapshots and deltas)
+		EntityT* findReplica(uint64_t id) const
+		{
+			auto it = m_replicas.find(size_t(id));
+			if (it == m_replicas.end())
+				return nullptr;
+			EntityT* e = getEntity(it->second);
+			return e && e->isAlive() ? e : nullptr;
+		}
+		// the IDs and values of the components I that changed after since, except for the entities that are sent completely (marks 1)
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type writeChanges(SnapshotWriter& w, std::vector<char>& out, uint64_t since,
+			const std::vector<char>& marks) const
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			writeChanges<T, I>(w, out, since, marks, TrackChanges<T>());
+			writeChanges<I + 1>(w, out, since, marks);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type writeChanges(SnapshotWriter&, std::vector<char>&, uint64_t,
+			const std::vector<char>&) const
+		{}
+		template<class T, size_t I>
+		void writeChanges(SnapshotWriter& w, std::vector<char>& out, uint64_t since, const std::vector<char>& marks, std::true_type) const
+		{
+			const auto& versions = m_changeVersions[TrackedIndex<I, TComponents...>::value];
+			std::vector<const EntityT*> changed;
+			for (size_t i = 0; i < versions.size(); i++)
+			{
+				if (versions[i] <= since || marks[i] == 1)
+					continue;
+				const EntityT* e = m_slots[i].entity;
+				if (e && e->m_componentsAdded && e->template hasComponent<T>())
+					changed.push_back(e);
+			}
+			w.write(uint64_t(changed.size()));
+			for (auto e : changed)
+				w.write(uint64_t(e->m_id));
+			const size_t length = w.size();
+			w.write(uint64_t(0));
+			for (auto e : changed)
+				Serializer<T>::write(w, const_cast<EntityT*>(e)->template getComponentUnchecked<T>());
+			const uint64_t bytes = uint64_t(w.size() - length - sizeof(uint64_t));
+			std::memcpy(out.data() + length, &bytes, sizeof(bytes));
+		}
+		template<class T, size_t I>
+		void writeChanges(SnapshotWriter&, std::vector<char>&, uint64_t, const std::vector<char>&, std::false_type) const
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents)), bool>::type readChanges(SnapshotReader& r,
+			std::array<DeltaColumn, sizeof...(TComponents)>& changes)
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			if (TrackChanges<T>::value)
+			{
+				uint64_t count = 0, bytes = 0;
+				r.read(count);
+				if (r.failed() || count > r.remaining() / sizeof(uint64_t))
+					return false;
+				changes[I].count = size_t(count);
+				changes[I].ids = r.skip(changes[I].count * sizeof(uint64_t));
+				r.read(bytes);
+				if (r.failed() || bytes > r.remaining())
+					return false;
+				// one value per changed entity
+				if (SerializedSize<T>::value && bytes != count * SerializedSize<T>::value)
+					return false;
+				changes[I].values = SnapshotReader(r.skip(size_t(bytes)), size_t(bytes));
+			}
+			return readChanges<I + 1>(r, changes);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents)), bool>::type readChanges(SnapshotReader& r,
+			std::array<DeltaColumn, sizeof...(TComponents)>&)
+		{
+			return !r.failed();
+		}
+		// copies the changed values into the components, values of unknown entities are skipped
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type applyChanges(std::array<DeltaColumn, sizeof...(TComponents)>& changes)
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			DeltaColumn& c = changes[I];
+			for (size_t i = 0; i < c.count; i++)
+			{
+				uint64_t id;
+				std::memcpy(&id, c.ids + i * sizeof(id), sizeof(id));
+				EntityT* e = findReplica(id);
+				if (e && e->template hasComponent<T>())
+					Serializer<T>::read(c.values, e->template getComponent<T>());
+				else
+				{
+					T ignored;
+					Serializer<T>::read(c.values, ignored);
+				}
+			}
+			applyChanges<I + 1>(changes);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type applyChanges(std::array<DeltaColumn, sizeof...(TComponents)>&)
+		{}
+		// adds and removes components of a spawned entity immediately
+		void setComponents(EntityT& e, const SystemKeyT& mask)
+		{
+			const SystemKeyT dense = mask & getDenseMask();
+			if (dense != e.m_componentFlags)
+			{
+#ifdef ECS_ARCHETYPE_STORAGE
+				e.m_staging = takeStaging();
+				migrateEntity(e, dense);
+				recycleStaging(e.m_staging);
+#else
+				migrateEntity(e, dense);
+#endif
+			}
+			setSparseComponents<0>(e, mask);
+		}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type setSparseComponents(EntityT& e, const SystemKeyT& mask)
+		{
+			using T = typename std::tuple_element<I, std::tuple<TComponents...>>::type;
+			if (SparseStorage<T>::value && mask.test(I) != e.m_sparseFlags.test(I))
+			{
+				if (mask.test(I))
+					e.template addSparseComponent<T>(I);
+				else
+					e.template removeSparseComponent<T>(I);
+			}
+			setSparseComponents<I + 1>(e, mask);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type setSparseComponents(EntityT&, const SystemKeyT&)
+		{}
+		// marks the non const components of Ts with change detection
+		template<typename... Ts>
+		static void markChanged(EntityT& e)
+		{
+			int expand[] = { 0, (e.template markChanged<Ts>(), 0)... };
+			(void)expand;
+		}
+#ifdef ECS_ARCHETYPE_STORAGE
+		template<typename... Ts>
+		static void markChanged(ArchetypeT& a, size_t begin, size_t end)
+		{
+			if (!HasMutableTracked<Ts...>::value)
+				return;
+			for (size_t i = begin; i != end; ++i)
+				markChanged<Ts...>(a.getEntity(i));
+		}
+#endif
+		/*
+		O(1) lookup of the query for TReq.
+		every TReq combination gets an index into m_queriesByType before main (see QueryIndex)
+		*/
+		template<typename... TReq>
+		Query& getQuery()
+		{
+			const size_t typeIndex = QueryIndex<TReq...>::value;
+			if (typeIndex < m_queriesByType.size() && m_queriesByType[typeIndex])
+				return *m_queriesByType[typeIndex];
+
+			// the query cache is not synchronized
+			assert(!m_parallelSystems && "queries of systems must be added in initQueries()");
+			// sparse components are tested while iterating (see forEachSparse)
+			Query& q = getQuery(ComponentKey<TReq...>::dense);
+			// index 0: the query was requested during static initialization
+			if (!typeIndex)
+				return q;
+			if (typeIndex >= m_queriesByType.size())
+				m_queriesByType.resize(typeIndex + 1, nullptr);
+			m_queriesByType[typeIndex] = &q;
+			return q;
+		}
+		/*
+		the index is a static member instead of a function local static, so getQuery() has no guard check.
+		it is initialized before main, queries used before that read 0 and are looked up by their key
+		*/
+		template<typename... TReq>
+		struct QueryIndex
+		{
+			static const size_t value;
+		};
+		static size_t nextQueryTypeIndex()
+		{
+			static std::atomic<size_t> counter{ 1 };
+			return counter++;
+		}
+		// index into m_resources, assigned before main like QueryIndex
+		template<class T>
+		struct ResourceIndex
+		{
+			static const size_t value;
+		};
+		template<class T>
+		static size_t getResourceIndex() noexcept
+		{
+			assert(ResourceIndex<T>::value && "resources can not be used during static initialization");
+			return ResourceIndex<T>::value;
+		}
+		static size_t nextResourceIndex()
+		{
+			static std::atomic<size_t> counter{ 1 };
+			return counter++;
+		}
+		/*
+		returns the cached query for the key.
+		a new query will be filled with the current entities and maintained from then on
+		*/
+		Query& getQuery(SystemKeyT key)
+		{
+			auto it = m_queryLookup.find(key);
+			if (it != m_queryLookup.end())
+				return *it->second;
+
+			m_queries.push_back(std::unique_ptr<Query>(new Query(key)));
+			Query& q = *m_queries.back();
+			q.index = m_queries.size() - 1;
+			m_queryLookup[key] = &q;
+			// future entities with a matching mask
+			for (auto& m : m_masks)
+			{
+				if (m.first.contains(key))
+					m.second.queries.push_back(&q);
+			}
+			q.entities.reserve(std::max(m_entities.size(), m_capacity.queryEntities));
+			q.refs.reserve(q.entities.capacity());
+			for (auto e : m_entities)
+			{
+				// the query was appended to the mask info of the entity
+				if (e->m_componentFlags.contains(key))
+					addToQuery(q, *e, m_masks.find(e->m_componentFlags)->second.queries.size() - 1);
+			}
+#ifdef ECS_ARCHETYPE_STORAGE
+			for (auto& a : m_archetypes)
+			{
+				if (a->getMask().contains(key))
+					q.archetypes.push_back(a.get());
+			}
+#endif
+			return q;
+		}
+		static TimeT nanosecondsSince(std::chrono::high_resolution_clock::time_point start)
+		{
+			return TimeT(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::high_resolution_clock::now() - start).count());
+		}
+		/*
+		timing history of a parallel loop, TCallsite is unique for every call site (lambdas have their own type).
+		returns nullptr for nested loops and loops during static initialization, they are executed on the calling thread
+		*/
+		template<typename TCallsite>
+		CostHistory* getCostHistory()
+		{
+			const size_t index = CostHistoryIndex<TCallsite>::value;
+			if (!index || m_parallelSystems || ThreadPool::insideTask())
+				return nullptr;
+			// a deque keeps the references of the running (outer) loops
+			if (index >= m_costHistories.size())
+				m_costHistories.resize(index + 1);
+			return &m_costHistories[index];
+		}
+		// index into m_costHistories, assigned before main like QueryIndex
+		template<typename TCallsite>
+		struct CostHistoryIndex
+		{
+			static const size_t value;
+		};
+		static size_t nextCostHistoryIndex()
 		{
-			m_entities.reserve(1024);
-			m_queries.reserve(64);
-			m_freshEntities.reserve(1024);
-			m_tempCachedQueries.reserve(1024);
-
-			// measure time till a thread start for parallel execution
-			std::chrono::high_resolution_clock clk;
-			auto start = clk.now();
-			auto end = start;
-			std::thread t1([&end, &clk]()
+			static std::atomic<size_t> counter{ 1 };
+			return counter++;
+		}
+		/*
+		predicted time for count elements on the given number of threads.
+		every additional woken up worker adds its share to the dispatch cost
+		*/
+		double predictTime(const CostHistory& h, size_t count, size_t threads) const
+		{
+			const double work = double(count) * h.costPerElement;
+			if (threads < 2)
+				return work;
+			return work / double(threads) + m_dispatchCost * double(threads) / double(m_nThreads);
+		}
+		// number of threads for the next call of the loop
+		size_t chooseThreads(CostHistory& h, size_t count) const
+		{
+			// the first call is measured on one thread (a single cold element is not representative)
+			if (h.costPerElement <= 0.0 || m_nThreads < 2 || count < 2)
+				return 1;
+			size_t best = 1;
+			double bestTime = predictTime(h, count, 1);
+			for (size_t t = 2; t <= std::min(m_nThreads, count); t++)
 			{
-				end = clk.now();
-			});
-			t1.join();
-			m_timeTillThreadStarts =
-				TimeT(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
-
-			// available Threads
-			m_nThreads = std::thread::hardware_concurrency();
-			// its better for the system to run core-1 threads, so the system has one thread for itself
-			m_nThreads = m_nThreads > 3 ? m_nThreads - 1 : m_nThreads;
+				const double time = predictTime(h, count, t);
+				if (time < bestTime)
+				{
+					best = t;
+					bestTime = time;
+				}
+			}
+			// only switch if the expected gain is significant, this prevents flipping between serial and parallel every frame
+			const size_t previous = std::min(h.threads, std::min(m_nThreads, count));
+			if (predictTime(h, count, previous) <= bestTime * 1.1)
+				best = previous;
+			h.threads = best;
+			return best;
 		}
-		template<typename... TReq>
-		void addQuery()
+		/*
+		executes body(begin, end) for [0, count) on as many threads as the history of the loop suggests,
+		the measured time per element is added to the history. without history the loop is executed on the calling thread
+		*/
+		template<typename TFunctor>
+		void parallelFor(const char* name, size_t count, CostHistory* history, TFunctor& body)
 		{
-			assert(m_state == States::Init);
-			// add systems before adding entities
-			static const std::tuple<TReq...> dummy;
-			auto binaryKey = getComponentMask(0, dummy);
-			// is system already added?
-			for (const auto& s : m_queries)
+#ifdef ECS_PROFILER
+			ProfileScope profile(m_profiler, name, count);
+#else
+			(void)name;
+#endif
+			if (!count)
+				return;
+			const size_t threads = history ? chooseThreads(*history, count) : 1;
+			auto tstart = std::chrono::high_resolution_clock::now();
+			double sample;
+			if (threads < 2)
 			{
-				// System already added!
-				if (s.first == binaryKey)
+				body(0, count);
+				if (!history)
 					return;
+				sample = double(nanosecondsSince(tstart)) / double(count);
+			}
+			else
+			{
+				// execute parallel on the worker pool and sum up the time the threads were busy
+				std::atomic<TimeT> busy{ 0 };
+				// commands are ordered by the first element of the range they were recorded in
+				beginCommandBatch();
+#ifdef ECS_PROFILER
+				profile.parallel = true;
+#endif
+				auto timedBody = [this, &body, &busy](size_t begin, size_t end)
+				{
+					ECS_PROFILE_SCOPE("task", end - begin);
+					auto tstart = std::chrono::high_resolution_clock::now();
+					getCommandBuffer().m_key = begin;
+					body(begin, end);
+					busy.fetch_add(nanosecondsSince(tstart));
+				};
+				if (m_schedule == ParallelSchedule::WorkStealing)
+				{
+					m_pool->runStealing(count, m_grainSize, timedBody, threads);
+				}
+				else
+				{
+					// the last range takes the remainder
+					const size_t step = count / threads;
+					auto task = [&timedBody, count, step, threads](size_t t)
+					{
+						timedBody(t * step, t == threads - 1 ? count : (t + 1) * step);
+					};
+					m_pool->run(threads, task);
+				}
+				beginCommandBatch();
+				const double wall = double(nanosecondsSince(tstart));
+				sample = double(busy.load()) / double(count);
+				// the time that was not spent within the body was needed to wake up the workers
+				const double overhead = std::max(wall - double(busy.load()) / double(threads), 0.0);
+				m_dispatchCost += (overhead * double(m_nThreads) / double(threads) - m_dispatchCost) * 0.1;
 			}
-			m_queries.push_back(std::make_pair(binaryKey, std::vector<shared_ptr<EntityT>>()));
-			m_queries.back().second.reserve(1024);
+			// exponential moving average
+			history->costPerElement += (sample - history->costPerElement) * (history->costPerElement > 0.0 ? 0.25 : 1.0);
 		}
-		void addSystem(shared_ptr<SystemT> s)
+		/*
+		returns the matching queries (and the archetype) for the component mask.
+		the information is created once per mask
+		*/
+		MaskInfo& getMaskInfo(SystemKeyT mask)
 		{
-			assert(m_state == States::Init);
-			s->m_manager = this;
-			m_systems.push_back(s);
+			auto it = m_masks.find(mask);
+			if (it != m_masks.end())
+				return it->second;
+
+			MaskInfo& info = m_masks[mask];
+			for (auto& q : m_queries)
+			{
+				if (mask.contains(q->key))
+					info.queries.push_back(q.get());
+			}
+#ifdef ECS_ARCHETYPE_STORAGE
+			// a new archetype will be registered in all matching queries
+			m_archetypes.push_back(std::unique_ptr<ArchetypeT>(new ArchetypeT(mask)));
+			info.archetype = m_archetypes.back().get();
+			for (auto q : info.queries)
+				q->archetypes.push_back(info.archetype);
+#endif
+			return info;
 		}
-		shared_ptr<EntityT> addEntity()
+		/*
+		a system is placed in the stage after the last previous system it conflicts with.
+		conflicting systems keep the order in which they were added
+		*/
+		void buildSystemStages()
 		{
-			assert(m_state == States::Running);
-			shared_ptr<EntityT> e = make_shared<EntityT>();
-			e->m_manager = this;
-			std::lock_guard<std::mutex> g(m_muEntityAdd);
+			m_systemStages.clear();
+			std::vector<size_t> stageOf(m_systems.size(), 0);
+			for (size_t i = 0; i < m_systems.size(); i++)
 			{
-				e->m_id = m_curID++;
-				// queue for adding (to prevent iterator lost when adding whilst iterating through entities)
-				m_freshEntities.push_back(e);
+				size_t stage = 0;
+				for (size_t j = 0; j < i; j++)
+				{
+					if (m_systems[i]->conflicts(*m_systems[j]))
+						stage = std::max(stage, stageOf[j] + 1);
+				}
+				stageOf[i] = stage;
+				if (stage >= m_systemStages.size())
+					m_systemStages.resize(stage + 1);
+				m_systemStages[stage].push_back(m_systems[i].get());
 			}
-			return e;
 		}
-		template<typename... TReq>
-		const std::vector<shared_ptr<EntityT>>& getEntsWith()
+		void runScriptGroups(float dt)
 		{
-			assert(m_state == States::Running);
-			static const std::tuple<TReq...> dummy;
-			auto binaryKey = getComponentMask(0, dummy);
-
-			// get binary key from system
-			for (auto& s : m_queries)
-				if (s.first == binaryKey)
-					return s.second;
-
-			// no cached system available...
+			if (m_scriptGroupsDirty)
+				buildScriptGroups();
+			for (auto& g : m_scriptGroups)
 			{
-				std::vector<shared_ptr<EntityT>> res;
-				res.reserve(m_entities.size());
-				for (const auto& e : m_entities)
+				auto& calls = g.calls;
+				ECS_PROFILE_SCOPE(g.name, calls.size());
+				if (!g.threadSafe)
 				{
-					if ((binaryKey & e->m_componentFlags) == binaryKey)
-						res.push_back(e);
+					for (auto& c : calls)
+						c.first->tickEntity(*c.second, dt);
+					continue;
 				}
-				m_tempCachedQueries.push_back(move(res));
-				return m_tempCachedQueries.back();
+				auto body = [&calls, dt](size_t begin, size_t end)
+				{
+					for (size_t i = begin; i != end; ++i)
+						calls[i].first->tickEntity(*calls[i].second, dt);
+				};
+				// like getCostHistory(), a pool that runs inline (e.g. within a WorldGroup) must not be measured
+				parallelFor(g.name, calls.size(), ThreadPool::insideTask() ? nullptr : &g.cost, body);
 			}
 		}
-		void tick(float dt)
+		// groups are ordered by the first entity that uses a script type
+		void buildScriptGroups()
 		{
-			assert(m_state == States::Running);
-			// remove dead entities + add entities with missing components
-			m_tempCachedQueries.resize(0);
-
-			// remove dead entities:
-			bool scriptRemoved = false;
-			SystemKeyT removedComponments = 0;
-			if (removeDeadEntities(m_entities, removedComponments, scriptRemoved))
+			for (auto& g : m_scriptGroups)
+				g.calls.resize(0);
+			for (auto e : m_scripted)
 			{
-				// probably some dead entites in here
-				for (auto& q : m_queries)
+				for (auto& script : e->m_scripts)
 				{
-					if(q.first & removedComponments)
+					const std::type_index type(typeid(*script));
+					auto it = m_scriptGroupLookup.find(type);
+					if (it == m_scriptGroupLookup.end())
 					{
-						// only remove entities if at least one component from the query was removed
-						removeDeadEntities(q.second);
+						it = m_scriptGroupLookup.insert(std::make_pair(type, m_scriptGroups.size())).first;
+						m_scriptGroups.push_back(ScriptGroup());
+						m_scriptGroups.back().threadSafe = script->isThreadSafe();
+						m_scriptGroups.back().name = typeid(*script).name();
 					}
+					m_scriptGroups[it->second].calls.push_back(std::make_pair(script.get(), e));
 				}
-				if (scriptRemoved)
-					removeDeadEntities(m_scripted);
 			}
+			m_scriptGroupsDirty = false;
+		}
+		// m_muEntityAdd must be locked
+		EntityT* createEntity()
+		{
+			EntityT* e = allocateEntity();
+			e->m_manager = this;
+#ifdef ECS_ARCHETYPE_STORAGE
+			// components are staged until the entity is moved into its archetype
+			e->m_staging = takeStaging();
+#endif
+			e->m_id = m_curID++;
+			// queue for adding (to prevent iterator lost when adding whilst iterating through entities)
+			m_freshEntities.push_back(e);
+			return e;
+		}
+		// commands recorded after this call will be applied after the previous commands
+		void beginCommandBatch()
+		{
+			m_commandBatch++;
+			for (auto& b : m_commandBuffers)
+			{
+				b->m_batch = m_commandBatch;
+				b->m_key = 0;
+			}
+		}
+		/*
+		applies the commands of all buffers.
+		the order only depends on the recorded (batch, key) and not on the thread that recorded a command
+		*/
+		void applyCommands()
+		{
+			m_commandOrder.resize(0);
+			for (size_t b = 0; b < m_commandBuffers.size(); b++)
+			{
+				const auto& cmds = m_commandBuffers[b]->m_commands;
+				for (size_t i = 0; i < cmds.size(); i++)
+					m_commandOrder.push_back(std::make_pair(b, i));
+			}
+			if (m_commandOrder.empty())
+				return;
+			ECS_PROFILE_SCOPE("applyCommands", m_commandOrder.size());
 
-			// add new components
-			if (m_freshEntities.size())
+			std::stable_sort(m_commandOrder.begin(), m_commandOrder.end(),
+				[this](const std::pair<size_t, size_t>& l, const std::pair<size_t, size_t>& r)
 			{
-				for (auto& e : m_freshEntities)
+				const auto& a = m_commandBuffers[l.first]->m_commands[l.second];
+				const auto& b = m_commandBuffers[r.first]->m_commands[r.second];
+				return a.batch != b.batch ? a.batch < b.batch : a.key < b.key;
+			});
+
+			for (const auto& o : m_commandOrder)
+			{
+				CommandBufferT& buffer = *m_commandBuffers[o.first];
+				const auto& c = buffer.m_commands[o.second];
+				switch (c.type)
 				{
-					assert(e->m_componentsAdded == false);
-					if (e->isAlive())
+				case CommandBufferT::CommandType::Spawn:
+				{
+					auto& s = buffer.m_spawns[c.index];
+					EntityT* e = nullptr;
 					{
-						// run startup script
-						e->runStartupScript();
-						// pass through systems
-						for (auto& s : m_systems)
-							s->onEntitySpawn(e);
-
-						e->m_componentsAdded = true;
-						m_entities.push_back(e);
-						// generate component key
-						auto entKey = getComponentKeyFromEntity(*e);
-						for (auto& s : m_queries)
-						{
-							if ((s.first & entKey) == s.first)
-								s.second.push_back(e);
-						}
-						if (e->hasScript())
-							m_scripted.push_back(e);
+						std::lock_guard<std::mutex> g(m_muEntityAdd);
+						e = createEntity();
 					}
+					e->components() = std::move(s.components);
+					e->setComponentFlags(s.mask);
+					for (auto& script : s.scripts)
+						e->addScript(script);
+				}
+				break;
+				case CommandBufferT::CommandType::Kill:
+					if (EntityT* e = getEntity(buffer.m_kills[c.index]))
+						e->kill();
+					break;
+				case CommandBufferT::CommandType::AddComponent:
+					applyAddComponent<0>(buffer, c.component, c.index);
+					break;
+				case CommandBufferT::CommandType::RemoveComponent:
+					if (EntityT* e = getEntity(buffer.m_removals[c.index]))
+						applyRemoveComponent<0>(*e, c.component);
+					break;
+				case CommandBufferT::CommandType::AddScript:
+					if (EntityT* e = getEntity(buffer.m_scripts[c.index].first))
+						e->addScript(buffer.m_scripts[c.index].second);
+					break;
 				}
-				m_freshEntities.resize(0);
 			}
-
-			// run systems
-			for (auto& s : m_systems)
-				s->tick(dt);
-
-			// run scripts for entities
-			for (auto& e : m_scripted)
-				if (e->hasScript())
-					e->runScript(dt);
+			for (auto& b : m_commandBuffers)
+				b->clear();
+			beginCommandBatch();
 		}
-		template<typename... TReq, typename TFunctor>
-		void forEach(TFunctor func)
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type applyAddComponent(CommandBufferT& buffer, size_t component, size_t index)
 		{
-			assert(m_state == States::Running);
-			for (auto& e : getEntsWith<TReq...>())
-				func(*e);
+			if (component != I)
+				return applyAddComponent<I + 1>(buffer, component, index);
+			auto& c = std::get<I>(buffer.m_components)[index];
+			if (EntityT* e = getEntity(c.first))
+				e->template addComponent<typename std::tuple_element<I, std::tuple<TComponents...>>::type>() = std::move(c.second);
 		}
-		template<typename... TReq, typename TFunctor>
-		void forEachParallel(TFunctor func)
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type applyAddComponent(CommandBufferT&, size_t, size_t)
 		{
-			assert(m_state == States::Running);
-			auto& vec = getEntsWith<TReq...>();
-			if (!vec.size())
-				return;
-			auto it = vec.begin();
-			const auto end = vec.end();
-
-			if (vec.size() > m_nThreads * 4)
-			{
-				// only if its really worth
-				// calculate time for one iteration
-				auto tstart = std::chrono::high_resolution_clock::now();
-				func(*(*it));
-				++it;
-				auto tend = std::chrono::high_resolution_clock::now();
-				TimeT duration =
-					TimeT(std::chrono::duration_cast<std::chrono::nanoseconds>(tend - tstart).count());
-
-				// calculate if splitting is worth
-				size_t step = (vec.size() - 1) / m_nThreads;
-				TimeT timeWithoutThreads = TimeT(vec.size() - 1) * duration;
-				TimeT timeWithThreads = TimeT(step) * duration + m_timeTillThreadStarts;
-
-				if (timeWithThreads < timeWithoutThreads)
-				{
-					// execute parallel
-					std::vector<std::thread> threads;
-					threads.reserve(m_nThreads);
-					for (size_t i = 0; i < m_nThreads - 1; i++)
-					{
-						threads.emplace_back([it, step, func]()
-						{
-							auto i = it; // because of capture thing
-							auto end = it + step;
-							while (i != end)
-							{
-								func(*(*i));
-								++i;
-							}
-						});
-						it += step;
-					}
-					// execute last on current threads
-					while (it != end)
-					{
-						func(*(*it));
-						++it;
-					}
-
-					for (auto& t : threads)
-						t.join();
-					return;
-				}
+			assert(false);
+		}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type applyRemoveComponent(EntityT& e, size_t component)
+		{
+			if (component != I)
+				return applyRemoveComponent<I + 1>(e, component);
+			e.template removeComponent<typename std::tuple_element<I, std::tuple<TComponents...>>::type>();
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type applyRemoveComponent(EntityT&, size_t)
+		{
+			assert(false);
+		}
+		// reserves at least size elements, but keeps the geometric growth of the vector (reserving the exact size reallocates on every spawn)
+		template<class TVector>
+		static void reserveGrowth(TVector& v, size_t size)
+		{
+			if (size > v.capacity())
+				v.reserve(std::max(size, 2 * v.capacity()));
+		}
+		// adds the used bytes of the vector to used and the unused capacity to the slack
+		template<class TVector>
+		static void countVector(const TVector& v, size_t& used, MemoryStats& s)
+		{
+			used += v.size() * sizeof(typename TVector::value_type);
+			s.slack += (v.capacity() - v.size()) * sizeof(typename TVector::value_type);
+		}
+#ifndef ECS_ARCHETYPE_STORAGE
+		// moves the tuple slots of the components the entity has from unusedComponents to components
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type countTupleComponents(const EntityT& e, MemoryStats& s) const
+		{
+			const size_t bytes = sizeof(typename std::tuple_element<I, std::tuple<TComponents...>>::type);
+			// sparse components are moved into their set when the entity is spawned
+			if (e.m_componentFlags.test(I) || (e.m_sparseFlags.test(I) && !e.m_componentsAdded))
+			{
+				s.components[I] += bytes;
+				s.unusedComponents -= bytes;
 			}
-			// execute on single thread
-			for (; it != end; ++it)
-				func(*(*it));
+			countTupleComponents<I + 1>(e, s);
 		}
-		void start()
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type countTupleComponents(const EntityT&, MemoryStats&) const
+		{}
+#else
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type countColumns(const ArchetypeT& a, MemoryStats& s) const
 		{
-			assert(m_state == States::Init);
-			// add queries
-			for (auto& s : m_systems)
-				s->initQueries(*this);
-
-			m_state = States::Running;
-
-			// init systems
-			for (auto& s : m_systems)
-				s->begin();
+			countVector(std::get<I>(a.m_columns), s.components[I], s);
+			countColumns<I + 1>(a, s);
 		}
-	private:
-		template<class T>
-		static constexpr size_t getComponentIndex()
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type countColumns(const ArchetypeT&, MemoryStats&) const
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type shrinkColumns(ArchetypeT& a)
 		{
-			// ReSharper disable once CppCStyleCast
-			return _getComponentIndex(0, (T*)(nullptr), std::tuple<TComponents...>());
+			std::get<I>(a.m_columns).shrink_to_fit();
+			shrinkColumns<I + 1>(a);
 		}
-		template<typename T, typename... TComps>
-		static constexpr size_t _getComponentIndex(size_t slot, T* dummy, const std::tuple<T, TComps...>& t)
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type shrinkColumns(ArchetypeT&)
+		{}
+#endif
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type countSparseSets(MemoryStats& s) const
 		{
-			return slot;
+			const auto& set = std::get<I>(m_sparseSets);
+			countVector(set.m_values, s.components[I], s);
+			countVector(set.m_entities, s.components[I], s);
+			countVector(set.m_sparse, s.components[I], s);
+			countSparseSets<I + 1>(s);
 		}
-		template<typename T, typename U, typename... TComps>
-		static constexpr size_t _getComponentIndex(size_t slot, T* dummy, const std::tuple<U, TComps...>& t)
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type countSparseSets(MemoryStats&) const
+		{}
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type shrinkSparseSets()
 		{
-			return _getComponentIndex(slot + 1, dummy, std::tuple<TComps...>());
+			auto& set = std::get<I>(m_sparseSets);
+			set.m_values.shrink_to_fit();
+			set.m_entities.shrink_to_fit();
+			set.m_sparse.shrink_to_fit();
+			shrinkSparseSets<I + 1>();
 		}
-		template<typename T>
-		static constexpr size_t _getComponentIndex(size_t slot, const T& dummy, const std::tuple<>&)
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type shrinkSparseSets()
+		{}
+		// takes a free slot or appends a new one
+		EntityT* allocateEntity()
 		{
-#ifdef _MSC_BUILD
-			// ReSharper disable once CppStaticAssertFailure
-			static_assert(false, "component type does not exist in this system");
+			uint32_t index;
+			if (m_freeSlots.size())
+			{
+				index = m_freeSlots.back();
+				m_freeSlots.pop_back();
+			}
+			else
+			{
+				assert(m_slots.size() < size_t(uint32_t(-1)));
+				index = uint32_t(m_slots.size());
+				m_slots.push_back(EntitySlot());
+				if (index / s_entitiesPerPage == m_pages.size())
+					m_pages.push_back(nullptr);
+			}
+			// pages without entities are released by shrinkToFit()
+			if (!m_pages[index / s_entitiesPerPage])
+				m_pages[index / s_entitiesPerPage] = static_cast<EntityT*>(
+					m_allocator->allocate(sizeof(EntityT) * s_entitiesPerPage, alignof(EntityT)));
+			auto& slot = m_slots[index];
+			slot.entity = new (m_pages[index / s_entitiesPerPage] + index % s_entitiesPerPage) EntityT();
+			slot.entity->m_handle = EntityHandle(index, slot.generation);
+			// reuse the script and query memory of the previous entity
+			slot.entity->m_scripts.swap(slot.scripts);
+			slot.entity->m_queryPositions.swap(slot.queryPositions);
+			return slot.entity;
+		}
+		// destructs the entity and invalidates all handles to it. the memory will be reused
+		void releaseEntity(EntityT& e)
+		{
+			const uint32_t index = e.m_handle.index;
+			auto& slot = m_slots[index];
+			assert(slot.entity == &e);
+			if (e.m_parent || e.m_children.size())
+				detachHierarchy(e);
+			slot.scripts.swap(e.m_scripts);
+			slot.scripts.clear();
+			slot.queryPositions.swap(e.m_queryPositions);
+			slot.queryPositions.clear();
+#ifdef ECS_ARCHETYPE_STORAGE
+			if (e.m_staging)
+				recycleStaging(e.m_staging);
 #endif
-			return -1;
+			e.~EntityT();
+			slot.entity = nullptr;
+			slot.generation++;
+			m_freeSlots.push_back(index);
 		}
-		template<typename T, typename... TComps>
-		static constexpr SystemKeyT getComponentMask(SystemKeyT key, const std::tuple<T, TComps...>& t)
+#ifdef ECS_ARCHETYPE_STORAGE
+		std::unique_ptr<std::tuple<TComponents...>> takeStaging()
 		{
-			return getComponentMask(key | SystemKeyT(1) << SystemKeyT(getComponentIndex<T>()), std::tuple<TComps...>());
+			if (m_stagingPool.empty())
+				return std::unique_ptr<std::tuple<TComponents...>>(new std::tuple<TComponents...>());
+			auto res = std::move(m_stagingPool.back());
+			m_stagingPool.pop_back();
+			return res;
 		}
-		static constexpr SystemKeyT getComponentMask(SystemKeyT key, const std::tuple<>& t)
+		void recycleStaging(std::unique_ptr<std::tuple<TComponents...>>& staging)
 		{
-			return key;
+			// the components were moved into the archetype or belong to a removed entity
+			*staging = std::tuple<TComponents...>();
+			m_stagingPool.push_back(std::move(staging));
 		}
-		static constexpr SystemKeyT getComponentKeyFromEntity(const EntityT& e)
+#endif
+		void setParent(EntityT& e, EntityT* parent)
 		{
-			return e.m_componentFlags;
+			assert(!ThreadPool::insideParallelTask() && !m_parallelSystems && "the hierarchy is not synchronized");
+			assert(!parent || parent->m_manager == this);
+			if (e.m_parent == parent)
+				return;
+#ifndef NDEBUG
+			for (auto p = parent; p; p = p->m_parent)
+				assert(p != &e && "an entity can not be its own ancestor");
+#endif
+			if (e.m_parent)
+				eraseChild(*e.m_parent, e);
+			e.m_parent = parent;
+			if (parent)
+				parent->m_children.push_back(&e);
+			updateDepths(e);
+		}
+		void eraseChild(EntityT& parent, EntityT& child)
+		{
+			auto& children = parent.m_children;
+			auto it = std::find(children.begin(), children.end(), &child);
+			assert(it != children.end());
+			*it = children.back();
+			children.pop_back();
+		}
+		// moves the entity and its descendants to the levels of their new depth
+		void updateDepths(EntityT& root)
+		{
+			m_hierarchyStack.assign(1, &root);
+			while (m_hierarchyStack.size())
+			{
+				EntityT& e = *m_hierarchyStack.back();
+				m_hierarchyStack.pop_back();
+				const size_t depth = e.m_parent ? e.m_parent->m_depth + 1 : 0;
+				// the depths within the subtree did not change
+				if (depth == e.m_depth)
+					continue;
+				if (e.m_depth)
+					removeFromLevel(e);
+				e.m_depth = depth;
+				if (depth)
+					addToLevel(e);
+				m_hierarchyStack.insert(m_hierarchyStack.end(), e.m_children.begin(), e.m_children.end());
+			}
+		}
+		void addToLevel(EntityT& e)
+		{
+			if (m_levels.size() < e.m_depth)
+				m_levels.resize(e.m_depth);
+			auto& level = m_levels[e.m_depth - 1];
+			e.m_levelIndex = level.size();
+			level.push_back(&e);
+		}
+		void removeFromLevel(EntityT& e)
+		{
+			auto& level = m_levels[e.m_depth - 1];
+			level[e.m_levelIndex] = level.back();
+			level[e.m_levelIndex]->m_levelIndex = e.m_levelIndex;
+			level.pop_back();
+			while (m_levels.size() && m_levels.back().empty())
+				m_levels.pop_back();
+		}
+		// the children of a removed entity become roots, they are killed as well
+		void detachHierarchy(EntityT& e)
+		{
+			for (auto c : e.m_children)
+			{
+				c->kill();
+				c->m_parent = nullptr;
+				updateDepths(*c);
+			}
+			e.m_children.clear();
+			if (e.m_parent)
+			{
+				eraseChild(*e.m_parent, e);
+				e.m_parent = nullptr;
+				updateDepths(e);
+			}
+		}
+		// m_killed of the calling thread
+		void registerKill(EntityT& e)
+		{
+			const size_t index = ThreadPool::getThreadIndex();
+			assert(index < m_killed.size());
+			m_killed[index].push_back(&e);
+		}
+		// m_migrations of the calling thread
+		void registerMigration(EntityT& e)
+		{
+#ifdef ECS_ARCHETYPE_STORAGE
+			{
+				// added components are staged until the entity moves to its new archetype
+				std::lock_guard<std::mutex> g(m_muEntityAdd);
+				e.m_staging = takeStaging();
+			}
+#endif
+			const size_t index = ThreadPool::getThreadIndex();
+			assert(index < m_migrations.size());
+			m_migrations[index].push_back(&e);
+		}
+		// moves entities with changed components to their new queries (ordered by ID)
+		void applyMigrations()
+		{
+			m_changing.resize(0);
+			for (auto& m : m_migrations)
+			{
+				m_changing.insert(m_changing.end(), m.begin(), m.end());
+				m.resize(0);
+			}
+			if (m_changing.empty())
+				return;
+			ECS_PROFILE_SCOPE("applyMigrations", m_changing.size());
+			std::sort(m_changing.begin(), m_changing.end(), [](const EntityT* l, const EntityT* r)
+			{
+				return l->getID() < r->getID();
+			});
+			for (auto e : m_changing)
+			{
+				e->m_migrating = false;
+				// killed entities keep their components until they are released
+				if (e->isAlive() && e->m_pendingFlags != e->m_componentFlags)
+					migrateEntity(*e, e->m_pendingFlags);
+#ifdef ECS_ARCHETYPE_STORAGE
+				recycleStaging(e->m_staging);
+#endif
+			}
 		}
 		/*
-		this will remove all dead entites in the vector with runtime O(n)
+		changes the components of a spawned entity.
+		only the queries that do not match both masks are changed
 		*/
-		void removeDeadEntities(std::vector<shared_ptr<EntityT>>& v)
+		void migrateEntity(EntityT& e, SystemKeyT mask)
 		{
-			// idea:
-
-			// find first dead entity from left
-			// find first living entity from right
-			// <- swap ->
-			// shrink list
-			if (!v.size()) return;
+			const SystemKeyT oldMask = e.m_componentFlags;
+			recordDelta(DeltaEvent::Migrated, e);
+			const MaskInfo& from = m_masks.find(oldMask)->second;
+			MaskInfo& to = getMaskInfo(mask);
 
-			size_t left = 0;
-			size_t right = v.size() - 1;
-			while (left <= right)
+			// both query lists are ordered by Query::index
+			m_positionScratch.resize(0);
+			size_t j = 0;
+			for (size_t i = 0; i < to.queries.size(); i++)
 			{
-				// is dead?
-				if (!v[left]->isAlive())
+				Query& q = *to.queries[i];
+				for (; j < from.queries.size() && from.queries[j]->index < q.index; j++)
+					removeFromQuery(*from.queries[j], e.m_queryPositions[j]);
+				if (j < from.queries.size() && from.queries[j] == &q)
 				{
-					// search first dead in right
-					while (right > left)
-					{
-						if (v[right]->isAlive())
-							break;
-						right--;
-						v.pop_back();
-					}
-					if (right > left)
-					{
-						// do the swap
-						std::swap(v[left], v[right]);
-						right--;
-					}
-					v.pop_back();
+					// still matching
+					const size_t position = e.m_queryPositions[j++];
+					q.refs[position] = i;
+					m_positionScratch.push_back(position);
+				}
+				else
+				{
+					m_positionScratch.push_back(q.entities.size());
+					q.entities.push_back(&e);
+					q.refs.push_back(i);
 				}
-				left++;
 			}
+			for (; j < from.queries.size(); j++)
+				removeFromQuery(*from.queries[j], e.m_queryPositions[j]);
+			e.m_queryPositions.swap(m_positionScratch);
+
+#ifdef ECS_ARCHETYPE_STORAGE
+			// the remaining components are moved from the old row, the added ones are already staged
+			e.m_archetype->template extractRow<0>(e.m_row, *e.m_staging, mask);
+			e.m_archetype->remove(e);
+			e.m_componentFlags = mask;
+			to.archetype->insert(e);
+#else
+			e.m_componentFlags = mask;
+			resetComponents<0>(e, oldMask);
+#endif
 		}
+#ifndef ECS_ARCHETYPE_STORAGE
+		// resets the components of the mask that the entity does not have anymore
+		template<size_t I>
+		typename std::enable_if<(I < sizeof...(TComponents))>::type resetComponents(EntityT& e, const SystemKeyT& mask)
+		{
+			if (mask.test(I) && !e.m_componentFlags.test(I))
+				std::get<I>(e.components()) = typename std::tuple_element<I, std::tuple<TComponents...>>::type();
+			resetComponents<I + 1>(e, mask);
+		}
+		template<size_t I>
+		typename std::enable_if<(I == sizeof...(TComponents))>::type resetComponents(EntityT&, const SystemKeyT&)
+		{}
+#endif
 		/*
-		this will remove all dead entites in the vector with runtime O(n)
-		returns true if dead entities were found
-		-> false if nothing was changed
-
-		rflag will indicate all removed components from entities
-		rscript will indicate if at least one removed entity had a script
+		removes the killed entities from all containers in O(number of queries of the entity).
+		the entities are processed ordered by their ID, independent of the thread that killed them
 		*/
-		bool removeDeadEntities(std::vector<shared_ptr<EntityT>>& v, SystemKeyT& rflag, bool& rscript)
+		void removeKilledEntities()
 		{
-			// idea:
-
-			// find first dead entity from left
-			// find first living entity from right
-			// <- swap ->
-			// shrink list
-			if (!v.size()) return false;
-
-			size_t left = 0;
-			size_t right = v.size() - 1;
-			size_t startSize = v.size();
-			rflag = 0;
-			rscript = false;
-			while (left <= right)
+#ifdef ECS_PROFILER
+			const long long profileStart = m_profiler.now();
+#endif
+			// systems can kill more entities within onEntityDeath
+			while (takeKilledEntities())
 			{
-				// is dead?
-				if (!v[left]->isAlive())
+				for (auto e : m_dying)
 				{
 					// trigger on death event
 					for (auto& s : m_systems)
-						s->onEntityDeath(v[left]);
-					rflag |= v[left]->m_componentFlags;
-					rscript = rscript || v[left]->hasScript();
+						s->onEntityDeath(*e);
+					// the children are removed in the next iteration
+					for (auto c : e->m_children)
+						c->kill();
+					recordDelta(DeltaEvent::Killed, *e);
+#ifdef ECS_ARCHETYPE_STORAGE
+					e->m_archetype->remove(*e);
+#endif
+					detachEntity(*e);
+					m_dead.push_back(e);
+				}
+			}
+#ifdef ECS_PROFILER
+			if (m_dead.size())
+				m_profiler.record("removeKilledEntities", profileStart, m_dead.size());
+#endif
+		}
+		// moves the killed entities of all threads into m_dying
+		bool takeKilledEntities()
+		{
+			m_dying.resize(0);
+			for (auto& k : m_killed)
+			{
+				m_dying.insert(m_dying.end(), k.begin(), k.end());
+				k.resize(0);
+			}
+			std::sort(m_dying.begin(), m_dying.end(), [](const EntityT* l, const EntityT* r)
+			{
+				return l->getID() < r->getID();
+			});
+			return !m_dying.empty();
+		}
+		// index is the position of the query in the MaskInfo::queries of the entity
+		void addToQuery(Query& q, EntityT& e, size_t index)
+		{
+			assert(e.m_queryPositions.size() == index);
+			e.m_queryPositions.push_back(q.entities.size());
+			q.entities.push_back(&e);
+			q.refs.push_back(index);
+		}
+		// moves the last entity of the query into the position
+		void removeFromQuery(Query& q, size_t position)
+		{
+			EntityT* moved = q.entities.back();
+			const size_t ref = q.refs.back();
+			q.entities[position] = moved;
+			q.refs[position] = ref;
+			moved->m_queryPositions[ref] = position;
+			q.entities.pop_back();
+			q.refs.pop_back();
+		}
+		// removes the entity from m_entities, m_scripted and its queries
+		void detachEntity(EntityT& e)
+		{
+			const MaskInfo& info = m_masks.find(e.m_componentFlags)->second;
+			assert(info.queries.size() == e.m_queryPositions.size());
+			for (size_t i = 0; i < info.queries.size(); i++)
+				removeFromQuery(*info.queries[i], e.m_queryPositions[i]);
+			e.m_queryPositions.clear();
+			if (!e.m_sparseFlags.none())
+				eraseSparseComponents<0>(e);
 
-					// search first dead in right
-					while (right > left)
-					{
-						if (v[right]->isAlive())
-							break;
-						// trigger on death event
-						for (auto& s : m_systems)
-							s->onEntityDeath(v[right]);
-						rflag |= v[right]->m_componentFlags;
-						rscript = rscript || v[right]->hasScript();
+			EntityT* last = m_entities.back();
+			m_entities[e.m_entityIndex] = last;
+			last->m_entityIndex = e.m_entityIndex;
+			m_entities.pop_back();
 
-						right--;
-						v.pop_back();
-					}
-					if (right > left)
-					{
-						// do the swap
-						std::swap(v[left], v[right]);
-						right--;
-					}
-					v.pop_back();
-				}
-				left++;
+			if (e.hasScript())
+			{
+				last = m_scripted.back();
+				m_scripted[e.m_scriptedIndex] = last;
+				last->m_scriptedIndex = e.m_scriptedIndex;
+				m_scripted.pop_back();
+				m_scriptGroupsDirty = true;
 			}
-			return startSize != v.size();
 		}
 	private:
+		struct EntitySlot
+		{
+			// nullptr if the slot is free
+			EntityT* entity = nullptr;
+			// incremented every time the entity of the slot is removed
+			uint32_t generation = 0;
+			// keeps the capacity of the script vector while the slot is free
+			std::vector<shared_ptr<typename EntityT::ScriptT>> scripts;
+			std::vector<size_t> queryPositions;
+		};
+		static const size_t s_entitiesPerPage = 256;
+		// "ECSS" and the version of the snapshot format
+		static const uint32_t s_snapshotMagic = 0x53534345;
+		static const uint32_t s_snapshotVersion = 1;
+		// "ECSD"
+		static const uint32_t s_deltaMagic = 0x44534345;
+		// number of entities of a chunk in forEachChunkParallel
+		static const size_t s_chunkSize = 256;
+	private:
+		// storage for all entities, EntityHandle::index refers to a slot
+		std::vector<EntitySlot> m_slots;
+		std::vector<uint32_t> m_freeSlots;
+		// slot i is located at m_pages[i / s_entitiesPerPage][i % s_entitiesPerPage], nullptr for released pages
+		std::vector<EntityT*> m_pages;
+		shared_ptr<Allocator> m_allocator;
+#ifdef ECS_ARCHETYPE_STORAGE
+		std::vector<std::unique_ptr<std::tuple<TComponents...>>> m_stagingPool;
+#endif
 		// all entities
-		std::vector<shared_ptr<EntityT>> m_entities;
+		std::vector<EntityT*> m_entities;
 		// entities that were not added to any system
-		std::vector<shared_ptr<EntityT>> m_freshEntities;
-		std::vector<std::vector<shared_ptr<EntityT>>> m_tempCachedQueries;
+		std::vector<EntityT*> m_freshEntities;
+		// removed entities that will be released at the end of the removal
+		std::vector<EntityT*> m_dead;
+		// entities with a parent, m_levels[d - 1] contains the entities of depth d
+		std::vector<std::vector<EntityT*>> m_levels;
+		std::vector<EntityT*> m_hierarchyStack;
+		// killed entities of every thread of m_pool (index ThreadPool::getThreadIndex())
+		std::vector<std::vector<EntityT*>> m_killed;
+		std::vector<EntityT*> m_dying;
+		// entities with pending component changes of every thread of m_pool
+		std::vector<std::vector<EntityT*>> m_migrations;
+		std::vector<EntityT*> m_changing;
+		std::vector<size_t> m_positionScratch;
 		size_t m_curID = 0;
-		std::vector<std::pair<SystemKeyT, std::vector<shared_ptr<EntityT>>>> m_queries;
-		std::vector<shared_ptr<EntityT>> m_scripted;
+		// queries are never removed, references to them stay valid
+		std::vector<std::unique_ptr<Query>> m_queries;
+		std::unordered_map<SystemKeyT, Query*, typename SystemKeyT::Hash> m_queryLookup;
+		// indexed by getQuery<TReq...>()
+		std::vector<Query*> m_queriesByType;
+		// indexed by getResourceIndex<T>(), empty for resources that were not added
+		std::vector<std::unique_ptr<ResourceBase>> m_resources;
+		std::unordered_map<SystemKeyT, MaskInfo, typename SystemKeyT::Hash> m_masks;
+		// only the sets of components with sparse storage are used
+		std::tuple<SparseSet<TComponents, EntityT>...> m_sparseSets;
+		// version of changes that are marked now (see advanceChangeVersion)
+		std::atomic<uint64_t> m_changeVersion{ 1 };
+		// last change of every slot for each component with change detection (ordered like TComponents)
+		std::array<std::vector<uint64_t>, TrackedCount<TComponents...>::value> m_changeVersions;
+		// spawned, killed and migrated entities for saveDelta() (only with setDeltaHistory(true))
+		bool m_deltaHistory = false;
+		std::vector<DeltaRecord> m_deltaLog;
+		// entities by ID for applyDelta(), rebuilt after loadSnapshot()
+		std::unordered_map<size_t, EntityHandle> m_replicas;
+		bool m_replicasValid = false;
+		// copies of queries for other threads and the function that copies the components of the query (see publishQuery)
+		struct Published
+		{
+			std::unique_ptr<PublishedQuery<TComponents...>> query;
+			void (Manager::*copy)(QueryFrame<TComponents...>&, const Query&);
+		};
+		std::vector<Published> m_published;
+		uint64_t m_tickCount = 0;
+#ifdef ECS_ARCHETYPE_STORAGE
+		std::vector<std::unique_ptr<ArchetypeT>> m_archetypes;
+#endif
+		std::vector<EntityT*> m_scripted;
+		// scripts of m_scripted grouped by type (see setScriptBatching)
+		struct ScriptGroup
+		{
+			std::vector<std::pair<ScriptT*, EntityT*>> calls;
+			bool threadSafe = false;
+			CostHistory cost;
+			// type name of the script
+			const char* name = nullptr;
+		};
+		std::vector<ScriptGroup> m_scriptGroups;
+		std::unordered_map<std::type_index, size_t> m_scriptGroupLookup;
+		bool m_scriptGroupsDirty = true;
+		bool m_scriptBatching = false;
 		std::vector<shared_ptr<SystemT>> m_systems;
+		// systems of a stage run at the same time, stages run in order
+		std::vector<std::vector<SystemT*>> m_systemStages;
+		bool m_parallelSystems = false;
 		States m_state = States::Init;
-		TimeT m_timeTillThreadStarts = 0;
+		ManagerCapacity m_capacity;
+		// estimated time to wake up all workers (in ns), updated by every parallel call
+		double m_dispatchCost = 0.0;
+		// histories of the parallel loops indexed by getCostHistory()
+		std::deque<CostHistory> m_costHistories;
+#ifdef ECS_PROFILER
+		Profiler m_profiler;
+#endif
 		size_t m_nThreads = 0;
+		shared_ptr<ThreadPool> m_pool;
+		ParallelSchedule m_schedule = ParallelSchedule::Static;
+		size_t m_grainSize = 64;
 		std::mutex m_muEntityAdd;
+		// structural changes within a parallel system stage (see Entity::lockStructure)
+		std::mutex m_muStructure;
+		// one buffer per thread of m_pool (index ThreadPool::getThreadIndex())
+		std::vector<std::unique_ptr<CommandBufferT>> m_commandBuffers;
+		std::vector<std::pair<size_t, size_t>> m_commandOrder;
+		uint64_t m_commandBatch = 0;
 	};
+
+	template<typename... TComponents>
+	template<typename... TReq>
+	constexpr typename Manager<TComponents...>::SystemKeyT Manager<TComponents...>::ComponentKey<TReq...>::value;
+	template<typename... TComponents>
+	template<typename... TReq>
+	constexpr typename Manager<TComponents...>::SystemKeyT Manager<TComponents...>::ComponentKey<TReq...>::sparse;
+	template<typename... TComponents>
+	template<typename... TReq>
+	constexpr typename Manager<TComponents...>::SystemKeyT Manager<TComponents...>::ComponentKey<TReq...>::dense;
+	template<typename... TComponents>
+	template<typename... TReq>
+	const size_t Manager<TComponents...>::QueryIndex<TReq...>::value = Manager<TComponents...>::nextQueryTypeIndex();
+	template<typename... TComponents>
+	template<class T>
+	const size_t Manager<TComponents...>::ResourceIndex<T>::value = Manager<TComponents...>::nextResourceIndex();
+	template<typename... TComponents>
+	template<typename TCallsite>
+	const size_t Manager<TComponents...>::CostHistoryIndex<TCallsite>::value = Manager<TComponents...>::nextCostHistoryIndex();
 }